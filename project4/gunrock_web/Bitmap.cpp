@@ -0,0 +1,104 @@
+#include <cstring>
+
+#include "Bitmap.h"
+
+using namespace std;
+
+Bitmap::Bitmap(unsigned char *bytes, int numBits) {
+  this->bytes = bytes;
+  this->numBits = numBits;
+  this->numBytes = (numBits + 7) / 8;
+}
+
+bool Bitmap::isSet(int index) {
+  return (bytes[index / 8] >> (index % 8)) & 1;
+}
+
+void Bitmap::set(int index) {
+  bytes[index / 8] |= (1 << (index % 8));
+}
+
+void Bitmap::clear(int index) {
+  bytes[index / 8] &= ~(1 << (index % 8));
+}
+
+uint64_t Bitmap::loadWord(int wordIndex) {
+  // The buffers have no alignment guarantees and the last word can run
+  // past the end, so copy whatever bytes we have into a zeroed word
+  uint64_t word = 0;
+  int offset = wordIndex * 8;
+  int length = numBytes - offset < 8 ? numBytes - offset : 8;
+  memcpy(&word, bytes + offset, length);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+int Bitmap::findFree(int start) {
+  if (start < 0) {
+    start = 0;
+  }
+
+  for (int wordIndex = start / 64; wordIndex * 64 < numBits; wordIndex++) {
+    uint64_t word = loadWord(wordIndex);
+    if (wordIndex == start / 64) {
+      // treat the bits before start as in use
+      word |= (((uint64_t) 1) << (start % 64)) - 1;
+    }
+    if (word != ~((uint64_t) 0)) {
+      int index = wordIndex * 64 + __builtin_ctzll(~word);
+      return index < numBits ? index : -1;
+    }
+  }
+  return -1;
+}
+
+int Bitmap::findSet(int start) {
+  if (start < 0) {
+    start = 0;
+  }
+
+  for (int wordIndex = start / 64; wordIndex * 64 < numBits; wordIndex++) {
+    uint64_t word = loadWord(wordIndex);
+    if (wordIndex == start / 64) {
+      // ignore the bits before start
+      word &= ~((((uint64_t) 1) << (start % 64)) - 1);
+    }
+    if (word != 0) {
+      int index = wordIndex * 64 + __builtin_ctzll(word);
+      return index < numBits ? index : -1;
+    }
+  }
+  return -1;
+}
+
+int Bitmap::findFreeRun(int length, int start) {
+  // hop from the start of each free run to the end of it
+  int runStart = findFree(start);
+  while (runStart >= 0) {
+    int runEnd = findSet(runStart);
+    if (runEnd < 0) {
+      runEnd = numBits;
+    }
+    if (runEnd - runStart >= length) {
+      return runStart;
+    }
+    runStart = findFree(runEnd);
+  }
+  return -1;
+}
+
+int Bitmap::countSet() {
+  int count = 0;
+  for (int wordIndex = 0; wordIndex * 64 < numBits; wordIndex++) {
+    uint64_t word = loadWord(wordIndex);
+    int bitsInWord = numBits - wordIndex * 64;
+    if (bitsInWord < 64) {
+      // ignore anything stored past the last bit
+      word &= (((uint64_t) 1) << bitsInWord) - 1;
+    }
+    count += __builtin_popcountll(word);
+  }
+  return count;
+}
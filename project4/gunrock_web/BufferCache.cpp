@@ -0,0 +1,132 @@
+#include <iostream>
+#include <cstring>
+
+#include "BufferCache.h"
+#include "ufs.h"
+
+using namespace std;
+
+BufferCache::BufferCache(Disk *disk, int capacityInBlocks, int numShards) {
+  this->disk = disk;
+  if (numShards < 1) {
+    numShards = 1;
+  }
+
+  // spread the capacity over the shards, but every shard holds at least one block
+  int perShard = capacityInBlocks / numShards;
+  if (perShard < 1) {
+    perShard = 1;
+  }
+
+  for (int idx = 0; idx < numShards; idx++) {
+    Shard *shard = new Shard();
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->capacity = perShard;
+    shard->hits = 0;
+    shard->misses = 0;
+    shards.push_back(shard);
+  }
+}
+
+BufferCache::~BufferCache() {
+  for (size_t idx = 0; idx < shards.size(); idx++) {
+    pthread_mutex_destroy(&shards[idx]->lock);
+    delete shards[idx];
+  }
+  shards.clear();
+}
+
+BufferCache::Shard *BufferCache::shardFor(int blockNumber) {
+  return shards[(unsigned int) blockNumber % shards.size()];
+}
+
+void BufferCache::readBlock(int blockNumber, void *buffer) {
+  Shard *shard = shardFor(blockNumber);
+  pthread_mutex_lock(&shard->lock);
+
+  unordered_map<int, Entry>::iterator iter = shard->entries.find(blockNumber);
+  if (iter != shard->entries.end()) {
+    shard->hits++;
+    shard->lru.splice(shard->lru.begin(), shard->lru, iter->second.lruPosition);
+    memcpy(buffer, iter->second.data.data(), UFS_BLOCK_SIZE);
+    pthread_mutex_unlock(&shard->lock);
+    return;
+  }
+
+  // We hold the shard lock across the disk read so that a concurrent
+  // write to this block can't slip in between and leave a stale copy.
+  // Blocks the open transaction has written aren't kept at all, since
+  // what we read is either its uncommitted data or about to be replaced.
+  shard->misses++;
+  if (!disk->readShareableBlock(blockNumber, buffer)) {
+    pthread_mutex_unlock(&shard->lock);
+    return;
+  }
+
+  if ((int) shard->entries.size() >= shard->capacity) {
+    int victim = shard->lru.back();
+    shard->lru.pop_back();
+    shard->entries.erase(victim);
+  }
+  shard->lru.push_front(blockNumber);
+  Entry &entry = shard->entries[blockNumber];
+  entry.data.assign((unsigned char *) buffer, (unsigned char *) buffer + UFS_BLOCK_SIZE);
+  entry.lruPosition = shard->lru.begin();
+
+  pthread_mutex_unlock(&shard->lock);
+}
+
+void BufferCache::writeBlock(int blockNumber, void *buffer) {
+  // The disk write can wait for another thread's transaction, so it
+  // happens outside the shard lock. Dropping the cached copy afterwards is
+  // enough, since a miss holds the shard lock across its disk read.
+  disk->writeBlock(blockNumber, buffer);
+  invalidate(blockNumber);
+}
+
+void BufferCache::writeBlocks(const vector<pair<int, const void *> > &blocks) {
+  disk->writeBlocks(blocks);
+  for (size_t idx = 0; idx < blocks.size(); idx++) {
+    invalidate(blocks[idx].first);
+  }
+}
+
+void BufferCache::invalidate(int blockNumber) {
+  Shard *shard = shardFor(blockNumber);
+  pthread_mutex_lock(&shard->lock);
+  unordered_map<int, Entry>::iterator iter = shard->entries.find(blockNumber);
+  if (iter != shard->entries.end()) {
+    shard->lru.erase(iter->second.lruPosition);
+    shard->entries.erase(iter);
+  }
+  pthread_mutex_unlock(&shard->lock);
+}
+
+void BufferCache::invalidateAll() {
+  for (size_t idx = 0; idx < shards.size(); idx++) {
+    pthread_mutex_lock(&shards[idx]->lock);
+    shards[idx]->entries.clear();
+    shards[idx]->lru.clear();
+    pthread_mutex_unlock(&shards[idx]->lock);
+  }
+}
+
+unsigned long BufferCache::hits() {
+  unsigned long total = 0;
+  for (size_t idx = 0; idx < shards.size(); idx++) {
+    pthread_mutex_lock(&shards[idx]->lock);
+    total += shards[idx]->hits;
+    pthread_mutex_unlock(&shards[idx]->lock);
+  }
+  return total;
+}
+
+unsigned long BufferCache::misses() {
+  unsigned long total = 0;
+  for (size_t idx = 0; idx < shards.size(); idx++) {
+    pthread_mutex_lock(&shards[idx]->lock);
+    total += shards[idx]->misses;
+    pthread_mutex_unlock(&shards[idx]->lock);
+  }
+  return total;
+}
@@ -1,8 +1,13 @@
 #include <iostream>
+#include <algorithm>
 #include <unistd.h>
 
 #include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -11,16 +16,33 @@
 
 #include "Disk.h"
 #include "dthread.h"
+#include "ufs.h"
 
 using namespace std;
 
-Disk::Disk(string imageFile, int blockSize) {
+Disk::Disk(string imageFile, int blockSize, Backend backend) {
   this->imageFile = imageFile;
   this->blockSize = blockSize;
+  this->backend = backend;
   this->isInTransaction = false;
-  
+  this->rollbackCount = 0;
+  this->commitCount = 0;
+  pthread_mutex_init(&this->transactionLock, NULL);
+  pthread_rwlock_init(&this->stateLock, NULL);
+  this->isWritable = true;
+  this->mappedImage = NULL;
+  this->journalAddr = 0;
+  this->journalLen = 0;
+  this->journalNext = 0;
+  this->journalSequence = 0;
+
   struct stat stat;
-  int imageFileDescriptor = open(imageFile.c_str(), O_RDONLY);
+  int imageFileDescriptor = open(imageFile.c_str(), O_RDWR);
+  if (imageFileDescriptor < 0 && (errno == EACCES || errno == EROFS)) {
+    // read-only images are fine as long as nobody tries to write to them
+    imageFileDescriptor = open(imageFile.c_str(), O_RDONLY);
+    this->isWritable = false;
+  }
   if (imageFileDescriptor < 0) {
     cerr << "could not open " << imageFile << endl;
     exit(1);
@@ -30,7 +52,13 @@ Disk::Disk(string imageFile, int blockSize) {
     cerr << "Could not stat image file" << endl;
     exit(1);
   }
-  close(imageFileDescriptor);
+
+  if (backend == PERSISTENT || backend == MMAP) {
+    this->imageFileDescriptor = imageFileDescriptor;
+  } else {
+    close(imageFileDescriptor);
+    this->imageFileDescriptor = -1;
+  }
   
   this->imageFileSize = stat.st_size;
 
@@ -41,19 +69,555 @@ Disk::Disk(string imageFile, int blockSize) {
     cerr << "  imageSize % blockSize: " << this->imageFileSize % this->blockSize << endl;
     exit(1);
   }
-  
+
+  if (backend == MMAP && this->imageFileSize > 0) {
+    int protection = PROT_READ | (this->isWritable ? PROT_WRITE : 0);
+    void *addr = mmap(NULL, this->imageFileSize, protection, MAP_SHARED, this->imageFileDescriptor, 0);
+    if (addr == MAP_FAILED) {
+      perror("mmap");
+      cerr << "Could not map image file " << imageFile << endl;
+      exit(1);
+    }
+    this->mappedImage = (unsigned char *) addr;
+  }
+}
+
+Disk::~Disk() {
+  // anything still in the write-back cache was never committed
+  dirtyBlocks.clear();
+  if (this->isWritable) {
+    checkpoint();
+  }
+
+  if (this->mappedImage != NULL) {
+    munmap(this->mappedImage, this->imageFileSize);
+    this->mappedImage = NULL;
+  }
+
+  if (this->imageFileDescriptor >= 0) {
+    close(this->imageFileDescriptor);
+    this->imageFileDescriptor = -1;
+  }
+
+  pthread_rwlock_destroy(&this->stateLock);
+  pthread_mutex_destroy(&this->transactionLock);
 }
 
 int Disk::numberOfBlocks() {
   return this->imageFileSize / this->blockSize;
 }
 
-void Disk::readBlock(int blockNumber, void *buffer) {
+const void *Disk::blockPtr(int blockNumber) {
+  checkBlockNumber(blockNumber);
+
+  // with blocks waiting in the journal, or written by our own open
+  // transaction, the mapping may be stale
+  pthread_rwlock_rdlock(&this->stateLock);
+  bool isStale = !journaledBlocks.empty() || (isTransactionOwner() && !dirtyBlocks.empty());
+  pthread_rwlock_unlock(&this->stateLock);
+  if (this->mappedImage == NULL || isStale) {
+    return NULL;
+  }
+  return this->mappedImage + (size_t) blockNumber * this->blockSize;
+}
+
+void Disk::checkBlockNumber(int blockNumber) {
   if (blockNumber < 0 || blockNumber >= this->numberOfBlocks()) {
     cerr << "Invalid block number " << blockNumber << endl;
     exit(1);
   }
+}
+
+void Disk::checkWritable() {
+  if (!this->isWritable) {
+    cerr << "Could not open image file " << this->imageFile << " for writing" << endl;
+    exit(1);
+  }
+}
+
+bool Disk::isTransactionOwner() {
+  return isInTransaction && pthread_equal(transactionOwner, pthread_self());
+}
+
+const unsigned char *Disk::bufferedBlock(int blockNumber, bool isOwner) {
+  // the thread in the transaction sees the writes it made earlier in it,
+  // everyone else only sees committed blocks
+  if (isOwner) {
+    map<int, vector<unsigned char> >::iterator dirty = dirtyBlocks.find(blockNumber);
+    if (dirty != dirtyBlocks.end()) {
+      return dirty->second.data();
+    }
+  }
+
+  // and committed writes that are still only in the journal
+  map<int, vector<unsigned char> >::iterator journaled = journaledBlocks.find(blockNumber);
+  if (journaled != journaledBlocks.end()) {
+    return journaled->second.data();
+  }
+
+  return NULL;
+}
+
+void Disk::readBlock(int blockNumber, void *buffer) {
+  readShareableBlock(blockNumber, buffer);
+}
+
+bool Disk::readShareableBlock(int blockNumber, void *buffer) {
+  checkBlockNumber(blockNumber);
+
+  pthread_rwlock_rdlock(&this->stateLock);
+  const unsigned char *buffered = bufferedBlock(blockNumber, isTransactionOwner());
+  if (buffered != NULL) {
+    memcpy(buffer, buffered, this->blockSize);
+  } else {
+    readImageBlock(blockNumber, buffer);
+  }
+  bool isShareable = dirtyBlocks.find(blockNumber) == dirtyBlocks.end();
+  pthread_rwlock_unlock(&this->stateLock);
+  return isShareable;
+}
+
+void Disk::writeBlock(int blockNumber, void *buffer) {  
+  writeBlocks(vector<pair<int, const void *> >(1, make_pair(blockNumber, (const void *) buffer)));
+}
+
+void Disk::readBlocks(const vector<pair<int, void *> > &blocks) {
+  for (size_t idx = 0; idx < blocks.size(); idx++) {
+    checkBlockNumber(blocks[idx].first);
+  }
+
+  pthread_rwlock_rdlock(&this->stateLock);
+  bool isOwner = isTransactionOwner();
+  size_t idx = 0;
+  while (idx < blocks.size()) {
+    const unsigned char *buffered = bufferedBlock(blocks[idx].first, isOwner);
+    if (buffered != NULL) {
+      memcpy(blocks[idx].second, buffered, this->blockSize);
+      idx++;
+      continue;
+    }
+
+    // extend the run while the block numbers are consecutive and the
+    // blocks have to come from the image
+    vector<unsigned char *> run(1, (unsigned char *) blocks[idx].second);
+    size_t next = idx + 1;
+    while (next < blocks.size() && blocks[next].first == blocks[next - 1].first + 1 &&
+           bufferedBlock(blocks[next].first, isOwner) == NULL) {
+      run.push_back((unsigned char *) blocks[next].second);
+      next++;
+    }
+    readImageRun(blocks[idx].first, run);
+    idx = next;
+  }
+  pthread_rwlock_unlock(&this->stateLock);
+}
+
+void Disk::writeBlocks(const vector<pair<int, const void *> > &blocks) {
+  if (blocks.empty()) {
+    return;
+  }
+  for (size_t idx = 0; idx < blocks.size(); idx++) {
+    checkBlockNumber(blocks[idx].first);
+  }
+  checkWritable();
+
+  // A write from outside the open transaction waits for it to finish and
+  // is then a transaction of its own
+  bool inTransaction = ownsTransaction();
+  if (!inTransaction) {
+    pthread_mutex_lock(&this->transactionLock);
+  }
+  pthread_rwlock_wrlock(&this->stateLock);
+
+  if (inTransaction || this->journalLen > 0) {
+    // hold the blocks in the write-back cache until commit
+    for (size_t idx = 0; idx < blocks.size(); idx++) {
+      const unsigned char *data = (const unsigned char *) blocks[idx].second;
+      dirtyBlocks[blocks[idx].first].assign(data, data + this->blockSize);
+    }
+    if (!inTransaction) {
+      // the whole list commits together
+      flushDirtyBlocks();
+    }
+  } else {
+    writeImageBlocksAndSync(blocks);
+  }
+
+  pthread_rwlock_unlock(&this->stateLock);
+  if (!inTransaction) {
+    pthread_mutex_unlock(&this->transactionLock);
+  }
+}
+
+void Disk::writeImageBlocksAndSync(const vector<pair<int, const void *> > &blocks) {
+  // sorting by block number turns the list into as few runs as possible,
+  // and a stable sort keeps the last write to a block last
+  vector<pair<int, const void *> > sorted(blocks);
+  stable_sort(sorted.begin(), sorted.end(),
+              [](const pair<int, const void *> &a, const pair<int, const void *> &b) {
+                return a.first < b.first;
+              });
+  size_t idx = 0;
+  while (idx < sorted.size()) {
+    vector<const unsigned char *> run(1, (const unsigned char *) sorted[idx].second);
+    size_t next = idx + 1;
+    while (next < sorted.size() && sorted[next].first == sorted[next - 1].first + 1) {
+      run.push_back((const unsigned char *) sorted[next].second);
+      next++;
+    }
+    writeImageRun(sorted[idx].first, run);
+    idx = next;
+  }
+  syncImage(sorted.front().first, sorted.back().first);
+}
+
+bool Disk::ownsTransaction() {
+  pthread_rwlock_rdlock(&this->stateLock);
+  bool owns = isTransactionOwner();
+  pthread_rwlock_unlock(&this->stateLock);
+  return owns;
+}
+
+void Disk::beginTransaction() {
+  if (ownsTransaction()) {
+    cerr << "You can't start a new transaction: one already exists" << endl;
+    exit(1);
+  }
+
+  // wait for any other thread's transaction to finish
+  pthread_mutex_lock(&this->transactionLock);
+  pthread_rwlock_wrlock(&this->stateLock);
+  isInTransaction = true;
+  transactionOwner = pthread_self();
+  pthread_rwlock_unlock(&this->stateLock);
+}
+
+void Disk::commit() {
+  // only the thread that began the transaction can end it
+  if (!ownsTransaction()) {
+    return;
+  }
+
+  pthread_rwlock_wrlock(&this->stateLock);
+  isInTransaction = false;
+  flushDirtyBlocks();
+  commitCount++;
+  pthread_rwlock_unlock(&this->stateLock);
+  pthread_mutex_unlock(&this->transactionLock);
+}
+
+void Disk::flushDirtyBlocks() {
+  if (dirtyBlocks.empty()) {
+    return;
+  }
+
+  int journalCapacity = this->journalLen - 2;
+  if (journalCapacity > (int) JOURNAL_DESC_PTRS) {
+    journalCapacity = JOURNAL_DESC_PTRS;
+  }
+  if (this->journalLen > 0 && (int) dirtyBlocks.size() <= journalCapacity) {
+    commitToJournal();
+    return;
+  }
+
+  // Either there is no journal or the transaction is too big for it. In
+  // the latter case we empty the journal first so that replaying it later
+  // can't overwrite these blocks with older contents.
+  checkpointJournal();
+
+  // dirtyBlocks is ordered by block number, so this writes the image
+  // front to back and then syncs everything at once
+  writeImageBlocks(dirtyBlocks);
+  syncImage(dirtyBlocks.begin()->first, dirtyBlocks.rbegin()->first);
+  dirtyBlocks.clear();
+}
 
+void Disk::rollback() {
+  if (!ownsTransaction()) {
+    return;
+  }
+
+  // nothing in the transaction has reached the image yet
+  pthread_rwlock_wrlock(&this->stateLock);
+  isInTransaction = false;
+  dirtyBlocks.clear();
+  rollbackCount++;
+  pthread_rwlock_unlock(&this->stateLock);
+  pthread_mutex_unlock(&this->transactionLock);
+}
+
+unsigned int Disk::rollbacks() {
+  pthread_rwlock_rdlock(&this->stateLock);
+  unsigned int count = rollbackCount;
+  pthread_rwlock_unlock(&this->stateLock);
+  return count;
+}
+
+unsigned int Disk::commits() {
+  pthread_rwlock_rdlock(&this->stateLock);
+  unsigned int count = commitCount;
+  pthread_rwlock_unlock(&this->stateLock);
+  return count;
+}
+
+void Disk::attachJournal(int journalAddr, int journalLen) {
+  if (journalLen < 2 || journalAddr <= 0 || journalAddr + journalLen > this->numberOfBlocks() ||
+      this->blockSize != UFS_BLOCK_SIZE) {
+    cerr << "Invalid journal region " << journalAddr << " [" << journalLen << "]" << endl;
+    exit(1);
+  }
+
+  unsigned char buffer[UFS_BLOCK_SIZE];
+  readImageBlock(journalAddr, buffer);
+  journal_super_t *journalSuper = (journal_super_t *) buffer;
+  if (journalSuper->magic != UFS_JOURNAL_MAGIC) {
+    cerr << "Invalid journal: bad magic number" << endl;
+    exit(1);
+  }
+
+  this->journalAddr = journalAddr;
+  this->journalLen = journalLen;
+  this->journalSequence = journalSuper->sequence;
+  this->journalNext = journalAddr + 1;
+
+  // Recovery: pick up every complete transaction with the sequence number
+  // we expect next. The first one that doesn't match or whose checksum is
+  // wrong marks the end of the journal.
+  int journalEnd = journalAddr + journalLen;
+  while (this->journalNext < journalEnd) {
+    journal_desc_t desc;
+    readImageBlock(this->journalNext, &desc);
+    if (desc.magic != UFS_JOURNAL_MAGIC || desc.sequence != this->journalSequence ||
+        desc.num_blocks == 0 || desc.num_blocks > JOURNAL_DESC_PTRS ||
+        this->journalNext + 1 + (int) desc.num_blocks > journalEnd) {
+      break;
+    }
+
+    vector<vector<unsigned char> > images(desc.num_blocks, vector<unsigned char>(this->blockSize));
+    vector<const unsigned char *> blocks;
+    bool valid = true;
+    for (unsigned int idx = 0; idx < desc.num_blocks; idx++) {
+      readImageBlock(this->journalNext + 1 + idx, images[idx].data());
+      blocks.push_back(images[idx].data());
+      if ((int) desc.blocks[idx] <= 0 || (int) desc.blocks[idx] >= journalAddr) {
+        valid = false;
+      }
+    }
+    unsigned int checksum = desc.checksum;
+    desc.checksum = 0;
+    if (!valid || journalChecksum(&desc, blocks) != checksum) {
+      break;
+    }
+
+    for (unsigned int idx = 0; idx < desc.num_blocks; idx++) {
+      journaledBlocks[desc.blocks[idx]].swap(images[idx]);
+    }
+    this->journalNext += 1 + desc.num_blocks;
+    this->journalSequence++;
+  }
+
+  // replay what we found so the image is up to date
+  if (this->isWritable) {
+    checkpoint();
+  }
+}
+
+void Disk::checkpoint() {
+  pthread_rwlock_wrlock(&this->stateLock);
+  checkpointJournal();
+  pthread_rwlock_unlock(&this->stateLock);
+}
+
+void Disk::checkpointJournal() {
+  if (this->journalLen == 0 || this->journalNext == this->journalAddr + 1) {
+    return;
+  }
+
+  writeImageBlocks(journaledBlocks);
+  if (!journaledBlocks.empty()) {
+    syncImage(journaledBlocks.begin()->first, journaledBlocks.rbegin()->first);
+  }
+
+  // Bumping the sequence number in the journal header invalidates every
+  // transaction currently in the journal.
+  writeJournalSuper();
+  journaledBlocks.clear();
+  this->journalNext = this->journalAddr + 1;
+}
+
+void Disk::commitToJournal() {
+  int numBlocks = dirtyBlocks.size();
+  if (this->journalNext + 1 + numBlocks > this->journalAddr + this->journalLen) {
+    checkpointJournal();
+  }
+
+  journal_desc_t desc;
+  memset(&desc, 0, sizeof(desc));
+  desc.magic = UFS_JOURNAL_MAGIC;
+  desc.sequence = this->journalSequence;
+  desc.num_blocks = numBlocks;
+
+  vector<const unsigned char *> blocks;
+  blocks.push_back((const unsigned char *) &desc);
+  map<int, vector<unsigned char> >::iterator iter;
+  int idx = 0;
+  for (iter = dirtyBlocks.begin(); iter != dirtyBlocks.end(); iter++) {
+    desc.blocks[idx++] = iter->first;
+    blocks.push_back(iter->second.data());
+  }
+  vector<const unsigned char *> images(blocks.begin() + 1, blocks.end());
+  desc.checksum = journalChecksum(&desc, images);
+
+  // the descriptor and block images go out as one sequential write
+  writeImageRun(this->journalNext, blocks);
+  syncImage(this->journalNext, this->journalNext + numBlocks);
+
+  this->journalNext += 1 + numBlocks;
+  this->journalSequence++;
+  for (iter = dirtyBlocks.begin(); iter != dirtyBlocks.end(); iter++) {
+    journaledBlocks[iter->first].swap(iter->second);
+  }
+  dirtyBlocks.clear();
+}
+
+void Disk::writeJournalSuper() {
+  unsigned char buffer[UFS_BLOCK_SIZE];
+  memset(buffer, 0, sizeof(buffer));
+  journal_super_t *journalSuper = (journal_super_t *) buffer;
+  journalSuper->magic = UFS_JOURNAL_MAGIC;
+  journalSuper->sequence = this->journalSequence;
+  writeImageBlock(this->journalAddr, buffer);
+  syncImage(this->journalAddr, this->journalAddr);
+}
+
+unsigned int Disk::journalChecksum(const void *desc, const vector<const unsigned char *> &blocks) {
+  // 32 bit FNV-1a
+  unsigned int hash = 2166136261u;
+  const unsigned char *bytes = (const unsigned char *) desc;
+  for (int idx = 0; idx < this->blockSize; idx++) {
+    hash = (hash ^ bytes[idx]) * 16777619u;
+  }
+  for (size_t block = 0; block < blocks.size(); block++) {
+    for (int idx = 0; idx < this->blockSize; idx++) {
+      hash = (hash ^ blocks[block][idx]) * 16777619u;
+    }
+  }
+  return hash;
+}
+
+void Disk::readImageBlock(int blockNumber, void *buffer) {
+  if (backend == MMAP) {
+    memcpy(buffer, this->mappedImage + (size_t) blockNumber * this->blockSize, this->blockSize);
+  } else if (backend == PERSISTENT) {
+    readBlockPersistent(blockNumber, buffer);
+  } else {
+    readBlockPerCall(blockNumber, buffer);
+  }
+}
+
+void Disk::writeImageBlock(int blockNumber, const void *buffer) {
+  if (backend == MMAP) {
+    memcpy(this->mappedImage + (size_t) blockNumber * this->blockSize, buffer, this->blockSize);
+  } else if (backend == PERSISTENT) {
+    writeBlockPersistent(blockNumber, buffer);
+  } else {
+    writeBlockPerCall(blockNumber, buffer);
+  }
+}
+
+void Disk::readImageRun(int firstBlock, const vector<unsigned char *> &blocks) {
+  if (backend != PERSISTENT) {
+    for (size_t idx = 0; idx < blocks.size(); idx++) {
+      readImageBlock(firstBlock + idx, blocks[idx]);
+    }
+    return;
+  }
+
+  size_t idx = 0;
+  while (idx < blocks.size()) {
+    vector<struct iovec> iov;
+    for (size_t next = idx; next < blocks.size() && iov.size() < IOV_MAX; next++) {
+      struct iovec vec;
+      vec.iov_base = blocks[next];
+      vec.iov_len = this->blockSize;
+      iov.push_back(vec);
+    }
+    off_t offset = (off_t) (firstBlock + idx) * this->blockSize;
+    ssize_t ret = preadv(this->imageFileDescriptor, iov.data(), iov.size(), offset);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret < this->blockSize) {
+      // no progress on a whole block, fall back to the single block path
+      readBlockPersistent(firstBlock + idx, blocks[idx]);
+      idx++;
+      continue;
+    }
+    idx += ret / this->blockSize;
+  }
+}
+
+void Disk::writeImageBlocks(const map<int, vector<unsigned char> > &blocks) {
+  // group consecutive block numbers into runs for writeImageRun
+  map<int, vector<unsigned char> >::const_iterator iter = blocks.begin();
+  while (iter != blocks.end()) {
+    int firstBlock = iter->first;
+    vector<const unsigned char *> run;
+    do {
+      run.push_back(iter->second.data());
+      iter++;
+    } while (iter != blocks.end() && iter->first == firstBlock + (int) run.size());
+    writeImageRun(firstBlock, run);
+  }
+}
+
+void Disk::writeImageRun(int firstBlock, const vector<const unsigned char *> &blocks) {
+  if (backend != PERSISTENT) {
+    for (size_t idx = 0; idx < blocks.size(); idx++) {
+      writeImageBlock(firstBlock + idx, blocks[idx]);
+    }
+    return;
+  }
+
+  // consecutive blocks go out with as few pwritev calls as possible
+  size_t idx = 0;
+  while (idx < blocks.size()) {
+    vector<struct iovec> iov;
+    for (size_t next = idx; next < blocks.size() && iov.size() < IOV_MAX; next++) {
+      struct iovec vec;
+      vec.iov_base = (void *) blocks[next];
+      vec.iov_len = this->blockSize;
+      iov.push_back(vec);
+    }
+    off_t offset = (off_t) (firstBlock + idx) * this->blockSize;
+    ssize_t ret = pwritev(this->imageFileDescriptor, iov.data(), iov.size(), offset);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret < this->blockSize) {
+      // no progress on a whole block, fall back to the single block path
+      writeBlockPersistent(firstBlock + idx, blocks[idx]);
+      idx++;
+      continue;
+    }
+    idx += ret / this->blockSize;
+  }
+}
+
+void Disk::syncImage(int firstBlock, int lastBlock) {
+  if (backend == MMAP) {
+    syncMapped(firstBlock, lastBlock);
+  } else if (backend == PERSISTENT) {
+    if (fdatasync(this->imageFileDescriptor) != 0) {
+      perror("fdatasync");
+      cerr << "Could not sync image file" << endl;
+      exit(1);
+    }
+  }
+  // OPEN_PER_CALL syncs each block as it writes it
+}
+
+void Disk::readBlockPerCall(int blockNumber, void *buffer) {
   int fd = open(this->imageFile.c_str(), O_RDONLY);
   if (fd < 0) {
     cerr << "Could not open image file " << this->imageFile << endl;
@@ -77,20 +641,7 @@ void Disk::readBlock(int blockNumber, void *buffer) {
   close(fd);
 }
 
-void Disk::writeBlock(int blockNumber, void *buffer) {  
-  if (blockNumber < 0 || blockNumber >= this->numberOfBlocks()) {
-    cerr << "Invalid block number " << blockNumber << endl;
-    exit(1);
-  }
-
-  if (isInTransaction) {
-    struct UndoRecord undoRecord;
-    undoRecord.blockNumber = blockNumber;
-    undoRecord.blockData = new unsigned char[blockSize];
-    this->readBlock(blockNumber, undoRecord.blockData);
-    undoLog.push_front(undoRecord);
-  }
-  
+void Disk::writeBlockPerCall(int blockNumber, const void *buffer) {
   int fd = open(this->imageFile.c_str(), O_RDWR);
   if (fd < 0) {
     cerr << "Could not open image file " << this->imageFile << endl;
@@ -114,29 +665,51 @@ void Disk::writeBlock(int blockNumber, void *buffer) {
   close(fd);
 }
 
-void Disk::beginTransaction() {
-  if (isInTransaction) {
-    cerr << "You can't start a new transaction: one already exists" << endl;
-    exit(1);
+void Disk::readBlockPersistent(int blockNumber, void *buffer) {
+  off_t offset = (off_t) blockNumber * this->blockSize;
+  int bytesRead = 0;
+  while (bytesRead < this->blockSize) {
+    ssize_t ret = pread(this->imageFileDescriptor, (char *) buffer + bytesRead,
+                        this->blockSize - bytesRead, offset + bytesRead);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      perror("read::pread");
+      cerr << "Could not read file" << endl;
+      exit(1);
+    }
+    bytesRead += ret;
   }
-  isInTransaction = true;
 }
 
-void Disk::commit() {
-  isInTransaction = false;
-  deque<struct UndoRecord>::iterator iter;
-  for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
-    delete [] iter->blockData;
+void Disk::writeBlockPersistent(int blockNumber, const void *buffer) {
+  off_t offset = (off_t) blockNumber * this->blockSize;
+  int bytesWritten = 0;
+  while (bytesWritten < this->blockSize) {
+    ssize_t ret = pwrite(this->imageFileDescriptor, (char *) buffer + bytesWritten,
+                         this->blockSize - bytesWritten, offset + bytesWritten);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      perror("write::pwrite");
+      cerr << "Could not write file" << endl;
+      exit(1);
+    }
+    bytesWritten += ret;
   }
-  undoLog.clear();
 }
 
-void Disk::rollback() {
-  isInTransaction = false;
-  deque<struct UndoRecord>::iterator iter;
-  for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
-    this->writeBlock(iter->blockNumber, iter->blockData);
-    delete [] iter->blockData;
+void Disk::syncMapped(int firstBlock, int lastBlock) {
+  // msync needs a page aligned address
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  size_t start = (size_t) firstBlock * this->blockSize;
+  size_t end = (size_t) (lastBlock + 1) * this->blockSize;
+  start -= start % pageSize;
+  if (msync(this->mappedImage + start, end - start, MS_SYNC) != 0) {
+    perror("msync");
+    cerr << "Could not sync image file" << endl;
+    exit(1);
   }
-  undoLog.clear();
 }
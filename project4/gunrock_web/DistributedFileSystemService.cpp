@@ -7,26 +7,253 @@
 #include <map>
 #include <string>
 #include <algorithm>
+#include <vector>
 
 #include "DistributedFileSystemService.h"
 #include "ClientError.h"
 #include "ufs.h"
 #include "WwwFormEncodedDict.h"
+#include "StringUtils.h"
 
 using namespace std;
 
+// Maps a LocalFileSystem error code to the ClientError the API reports
+static ClientError errorFor(int ret) {
+  switch (-ret) {
+  case ENOTFOUND:
+    return ClientError::notFound();
+  case ENOTENOUGHSPACE:
+    return ClientError::insufficientStorage();
+  case EINVALIDTYPE:
+  case EINVALIDINODE:
+    return ClientError::conflict();
+  default:
+    return ClientError::badRequest();
+  }
+}
+
+// Builds an absolute path out of the first count path components
+static string joinPath(const vector<string> &components, size_t count) {
+  string path = "/";
+  for (size_t idx = 0; idx < count; idx++) {
+    if (idx > 0) {
+      path += "/";
+    }
+    path += components[idx];
+  }
+  return path;
+}
+
 DistributedFileSystemService::DistributedFileSystemService(string diskFile) : HttpService("/ds3/") {
   this->fileSystem = new LocalFileSystem(new Disk(diskFile, UFS_BLOCK_SIZE));
+
+  char id[32];
+  snprintf(id, sizeof(id), "%lx.%x", (unsigned long) time(NULL), (unsigned int) getpid());
+  this->instanceId = id;
+  pthread_mutex_init(&this->generationLock, NULL);
 }  
 
+string DistributedFileSystemService::inodeETag(int inodeNumber) {
+  pthread_mutex_lock(&this->generationLock);
+  unsigned long generation = generations[inodeNumber];
+  pthread_mutex_unlock(&this->generationLock);
+
+  stringstream etag;
+  etag << "\"" << instanceId << "-" << inodeNumber << "-" << generation << "\"";
+  return etag.str();
+}
+
+void DistributedFileSystemService::bumpGenerations(const vector<int> &inodeNumbers) {
+  pthread_mutex_lock(&this->generationLock);
+  for (size_t idx = 0; idx < inodeNumbers.size(); idx++) {
+    generations[inodeNumbers[idx]]++;
+  }
+  pthread_mutex_unlock(&this->generationLock);
+}
+
+vector<string> DistributedFileSystemService::pathComponents(HTTPRequest *request) {
+  // drop the leading "ds3" that routed the request to us
+  vector<string> components = request->getPathComponents();
+  if (!components.empty()) {
+    components.erase(components.begin());
+  }
+  return components;
+}
+
+int DistributedFileSystemService::responseSize(string path) {
+  // the inode size is the file size, or a bound on the listing of a directory
+  vector<string> components = StringUtils::split(path, '/');
+  if (!components.empty()) {
+    components.erase(components.begin());
+  }
+  int inodeNumber = this->fileSystem->resolvePath(joinPath(components, components.size()));
+  inode_t inode;
+  if (inodeNumber < 0 || this->fileSystem->stat(inodeNumber, &inode) != 0) {
+    return 0;
+  }
+  return inode.size;
+}
+
 void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *response) {
-  response->setBody("");
+  vector<string> components = this->pathComponents(request);
+  int inodeNumber = this->fileSystem->resolvePath(joinPath(components, components.size()));
+  if (inodeNumber < 0) {
+    throw ClientError::notFound();
+  }
+
+  // We read the generation before anything else about the inode and put
+  // bumps it after its commit, so contents may go out with an ETag that is
+  // about to be stale, but never with one that stays current
+  string etag = inodeETag(inodeNumber);
+  inode_t inode;
+  if (this->fileSystem->stat(inodeNumber, &inode) != 0) {
+    throw ClientError::notFound();
+  }
+  if (checkNotModified(request, response, etag, 0)) {
+    return;
+  }
+
+  if (inode.type == UFS_REGULAR_FILE) {
+    vector<pair<off_t, off_t> > ranges = requestedRanges(request, response, inode.size, etag);
+    if (ranges.empty()) {
+      string contents(inode.size, '\0');
+      int bytesRead = this->fileSystem->read(inodeNumber, &contents[0], inode.size);
+      if (bytesRead < 0) {
+        throw errorFor(bytesRead);
+      }
+      contents.resize(bytesRead);
+      response->setBody(contents);
+      return;
+    }
+
+    // pread only touches the blocks that hold each range
+    vector<string> parts;
+    for (size_t idx = 0; idx < ranges.size(); idx++) {
+      string part(ranges[idx].second - ranges[idx].first + 1, '\0');
+      int bytesRead = this->fileSystem->pread(inodeNumber, &part[0], part.size(), ranges[idx].first);
+      if (bytesRead < 0) {
+        throw errorFor(bytesRead);
+      }
+      part.resize(bytesRead);
+      parts.push_back(part);
+    }
+    setPartialBody(response, ranges, parts, inode.size);
+    return;
+  }
+
+  string contents(inode.size, '\0');
+  int bytesRead = this->fileSystem->read(inodeNumber, &contents[0], inode.size);
+  if (bytesRead < 0) {
+    throw errorFor(bytesRead);
+  }
+  contents.resize(bytesRead);
+
+  // directories list their entries by name, one per line, with a
+  // trailing "/" on the ones that are directories themselves
+  vector<string> names;
+  const dir_ent_t *entries = (const dir_ent_t *) contents.data();
+  for (size_t idx = 0; idx < contents.size() / sizeof(dir_ent_t); idx++) {
+    string name = entries[idx].name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    inode_t entryInode;
+    if (this->fileSystem->stat(entries[idx].inum, &entryInode) == 0 && entryInode.type == UFS_DIRECTORY) {
+      name += "/";
+    }
+    names.push_back(name);
+  }
+  sort(names.begin(), names.end());
+
+  string body;
+  for (size_t idx = 0; idx < names.size(); idx++) {
+    body += names[idx] + "\n";
+  }
+
+  vector<pair<off_t, off_t> > ranges = requestedRanges(request, response, body.size(), etag);
+  if (ranges.empty()) {
+    response->setBody(body);
+    return;
+  }
+  vector<string> parts;
+  for (size_t idx = 0; idx < ranges.size(); idx++) {
+    parts.push_back(body.substr(ranges[idx].first, ranges[idx].second - ranges[idx].first + 1));
+  }
+  setPartialBody(response, ranges, parts, body.size());
 }
 
 void DistributedFileSystemService::put(HTTPRequest *request, HTTPResponse *response) {
+  vector<string> components = this->pathComponents(request);
+  if (components.empty()) {
+    throw ClientError::badRequest();
+  }
+  string body = request->getBody();
+
+  // everything along the path may have changed
+  vector<int> changed(1, UFS_ROOT_DIRECTORY_INODE_NUMBER);
+  Disk *disk = this->fileSystem->disk;
+  disk->beginTransaction();
+  try {
+    // create any missing directories along the way, create returns the
+    // existing inode for ones that are already there
+    int parentInodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+    for (size_t idx = 0; idx + 1 < components.size(); idx++) {
+      int ret = this->fileSystem->create(parentInodeNumber, UFS_DIRECTORY, components[idx]);
+      if (ret < 0) {
+        throw errorFor(ret);
+      }
+      parentInodeNumber = ret;
+      changed.push_back(ret);
+    }
+
+    int inodeNumber = this->fileSystem->create(parentInodeNumber, UFS_REGULAR_FILE, components.back());
+    if (inodeNumber < 0) {
+      throw errorFor(inodeNumber);
+    }
+    changed.push_back(inodeNumber);
+    int bytesWritten = this->fileSystem->write(inodeNumber, body.data(), body.size());
+    if (bytesWritten < 0) {
+      throw errorFor(bytesWritten);
+    } else if (bytesWritten != (int) body.size()) {
+      throw ClientError::insufficientStorage();
+    }
+  } catch (...) {
+    disk->rollback();
+    throw;
+  }
+  disk->commit();
+  bumpGenerations(changed);
   response->setBody("");
 }
 
 void DistributedFileSystemService::del(HTTPRequest *request, HTTPResponse *response) {
+  vector<string> components = this->pathComponents(request);
+  if (components.empty()) {
+    // can't delete the root directory
+    throw ClientError::badRequest();
+  }
+  int inodeNumber = this->fileSystem->resolvePath(joinPath(components, components.size()));
+  if (inodeNumber < 0) {
+    throw ClientError::notFound();
+  }
+  int parentInodeNumber = this->fileSystem->resolvePath(joinPath(components, components.size() - 1));
+  if (parentInodeNumber < 0) {
+    throw ClientError::notFound();
+  }
+
+  Disk *disk = this->fileSystem->disk;
+  disk->beginTransaction();
+  int ret = this->fileSystem->unlink(parentInodeNumber, components.back());
+  if (ret < 0) {
+    // errors map the same way as for put, so only a directory that
+    // isn't empty is a bad request
+    disk->rollback();
+    throw errorFor(ret);
+  }
+  disk->commit();
+  vector<int> changed;
+  changed.push_back(parentInodeNumber);
+  changed.push_back(inodeNumber);
+  bumpGenerations(changed);
   response->setBody("");
 }
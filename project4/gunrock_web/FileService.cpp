@@ -2,13 +2,20 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <zlib.h>
 
 #include <iostream>
 #include <map>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "FileService.h"
 #include "ClientError.h"
+#include "StringUtils.h"
 
 using namespace std;
 
@@ -23,6 +30,12 @@ FileService::FileService(string basedir) : HttpService("/") {
   }
   
   this->m_basedir = basedir;
+  this->m_cacheBytes = 0;
+  pthread_mutex_init(&this->m_cacheLock, NULL);
+}
+
+FileService::~FileService() {
+  pthread_mutex_destroy(&this->m_cacheLock);
 }
 
 bool FileService::endswith(string str, string suffix) {
@@ -30,19 +43,299 @@ bool FileService::endswith(string str, string suffix) {
   return pos == (str.length() - suffix.length());
 }
 
+// Compresses in into a gzip stream
+static bool gzipCompress(const string &in, string &out) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // 16 more window bits asks zlib for a gzip header and trailer
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+
+  out.resize(deflateBound(&stream, in.size()));
+  stream.next_in = (Bytef *) in.data();
+  stream.avail_in = in.size();
+  stream.next_out = (Bytef *) &out[0];
+  stream.avail_out = out.size();
+  int ret = deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return ret == Z_STREAM_END;
+}
+
 void FileService::get(HTTPRequest *request, HTTPResponse *response) {
   string path = this->m_basedir + request->getPath();
-  string fileContents = this->readFile(path);
-  if (fileContents.size() == 0) {
+
+  // an empty file or a directory is treated as missing
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    throw ClientError::notFound();
+  }
+
+  // the content type is the original's whatever encoding we send
+  setContentType(path, response);
+  response->setHeader("Vary", "Accept-Encoding");
+  bool acceptsGzip = this->acceptsGzip(request);
+
+  // a precompressed .gz next to the file wins over compressing it here
+  if (acceptsGzip) {
+    string gzipPath = path + ".gz";
+    struct stat gzipSt;
+    if (stat(gzipPath.c_str(), &gzipSt) == 0 && S_ISREG(gzipSt.st_mode) && gzipSt.st_size > 0) {
+      serveFile(request, response, gzipPath, gzipSt, true, false);
+      return;
+    }
+  }
+
+  serveFile(request, response, path, st, false, acceptsGzip && isCompressible(path));
+}
+
+void FileService::serveFile(HTTPRequest *request, HTTPResponse *response, string path,
+                            struct stat st, bool isGzipped, bool compress) {
+  char etag[64];
+  snprintf(etag, sizeof(etag), "%lx-%lx%08lx", (unsigned long) st.st_size,
+           (unsigned long) st.st_mtim.tv_sec, (unsigned long) st.st_mtim.tv_nsec);
+  string quotedETag = string("\"") + etag + "\"";
+
+  shared_ptr<const string> contents;
+  if ((size_t) st.st_size <= MAX_CACHED_FILE_SIZE) {
+    contents = cachedContents(path, st);
+    shared_ptr<const string> gzipped;
+    if (contents && compress && (gzipped = cachedGzip(path, contents))) {
+      // each encoding is a different representation with its own ETag
+      contents = gzipped;
+      isGzipped = true;
+      quotedETag = string("\"") + etag + "-gzip\"";
+    }
+  }
+
+  // a client that already has this version gets a 304 without us sending
+  // anything
+  if (checkNotModified(request, response, quotedETag, st.st_mtim.tv_sec)) {
+    return;
+  }
+
+  off_t size = contents ? contents->size() : st.st_size;
+  vector<pair<off_t, off_t> > ranges = requestedRanges(request, response, size, quotedETag);
+  // Content-Encoding describes the body, so a 304 or an error doesn't get it
+  if (contents) {
+    if (isGzipped) {
+      response->setHeader("Content-Encoding", "gzip");
+    }
+    if (ranges.empty()) {
+      response->setBody(contents);
+    } else {
+      vector<string> parts;
+      for (size_t idx = 0; idx < ranges.size(); idx++) {
+        parts.push_back(contents->substr(ranges[idx].first, ranges[idx].second - ranges[idx].first + 1));
+      }
+      setPartialBody(response, ranges, parts, size);
+    }
+    return;
+  }
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
     throw ClientError::notFound();
+  }
+  // the file may have changed since the stat above
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    throw ClientError::notFound();
+  }
+  if (st.st_size != size) {
+    // the ranges were for the old size
+    ranges.clear();
+  }
+  if (isGzipped) {
+    response->setHeader("Content-Encoding", "gzip");
+  }
+
+  if (ranges.empty()) {
+    // the response sends the file with sendfile and closes it
+    response->setBodyFile(fd, 0, st.st_size);
+  } else if (ranges.size() == 1) {
+    // so does a single range, straight from its offset in the file
+    response->setStatus(206);
+    response->setHeader("Content-Range", contentRange(ranges[0], st.st_size));
+    response->setBodyFile(fd, ranges[0].first, ranges[0].second - ranges[0].first + 1);
   } else {
-    if (this->endswith(path, ".css")) {
-      response->setContentType("text/css");
-    } else if (this->endswith(path, ".js")) {
-      response->setContentType("text/javascript");
+    vector<string> parts;
+    for (size_t idx = 0; idx < ranges.size(); idx++) {
+      string part(ranges[idx].second - ranges[idx].first + 1, '\0');
+      size_t done = 0;
+      while (done < part.size()) {
+        ssize_t ret = pread(fd, &part[done], part.size() - done, ranges[idx].first + done);
+        if (ret <= 0) {
+          break;
+        }
+        done += ret;
+      }
+      part.resize(done);
+      parts.push_back(part);
+    }
+    close(fd);
+    setPartialBody(response, ranges, parts, st.st_size);
+  }
+}
+
+bool FileService::acceptsGzip(HTTPRequest *request) {
+  string header;
+  try {
+    header = request->getHeader("Accept-Encoding");
+  } catch (...) {
+    return false;
+  }
+
+  // gzip is acceptable if it, or failing that "*", is listed without q=0
+  double gzipQuality = -1;
+  double anyQuality = -1;
+  vector<string> codings = StringUtils::split(header, ',');
+  for (size_t idx = 0; idx < codings.size(); idx++) {
+    vector<string> params = StringUtils::split(codings[idx], ';');
+    if (params.empty()) {
+      continue;
+    }
+    string name = params[0];
+    name.erase(0, name.find_first_not_of(" \t"));
+    name.erase(name.find_last_not_of(" \t") + 1);
+
+    double quality = 1;
+    for (size_t param = 1; param < params.size(); param++) {
+      size_t q = params[param].find("q=");
+      if (q != string::npos) {
+        quality = strtod(params[param].c_str() + q + 2, NULL);
+      }
+    }
+
+    if (strcasecmp(name.c_str(), "gzip") == 0 || strcasecmp(name.c_str(), "x-gzip") == 0) {
+      gzipQuality = quality;
+    } else if (name == "*") {
+      anyQuality = quality;
+    }
+  }
+  return gzipQuality >= 0 ? gzipQuality > 0 : anyQuality > 0;
+}
+
+bool FileService::isCompressible(string path) {
+  // text compresses well, and everything we serve that isn't text is
+  // already compressed
+  const char *extensions[] = {".html", ".htm", ".css", ".js", ".txt", ".json", ".svg", ".xml"};
+  for (size_t idx = 0; idx < sizeof(extensions) / sizeof(extensions[0]); idx++) {
+    if (this->endswith(path, extensions[idx])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void FileService::setContentType(string path, HTTPResponse *response) {
+  if (this->endswith(path, ".css")) {
+    response->setContentType("text/css");
+  } else if (this->endswith(path, ".js")) {
+    response->setContentType("text/javascript");
+  }
+}
+
+shared_ptr<const string> FileService::cachedContents(string path, const struct stat &st) {
+  pthread_mutex_lock(&this->m_cacheLock);
+  unordered_map<string, CachedFile>::iterator iter = m_cache.find(path);
+  if (iter != m_cache.end()) {
+    CachedFile &cached = iter->second;
+    if (cached.inode == st.st_ino && cached.size == st.st_size &&
+        cached.mtime.tv_sec == st.st_mtim.tv_sec && cached.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+      m_lru.splice(m_lru.begin(), m_lru, cached.lruPosition);
+      shared_ptr<const string> contents = cached.contents;
+      pthread_mutex_unlock(&this->m_cacheLock);
+      return contents;
+    }
+
+    // stale, the file changed since we read it
+    m_cacheBytes -= cached.bytes;
+    m_lru.erase(cached.lruPosition);
+    m_cache.erase(iter);
+  }
+  pthread_mutex_unlock(&this->m_cacheLock);
+
+  // read without holding the lock so other files are served meanwhile
+  shared_ptr<const string> contents = make_shared<const string>(readFile(path));
+  if (contents->size() != (size_t) st.st_size) {
+    // changed while we were reading, so let the caller send it directly
+    return shared_ptr<const string>();
+  }
+
+  pthread_mutex_lock(&this->m_cacheLock);
+  if (m_cache.find(path) == m_cache.end()) {
+    m_lru.push_front(path);
+    CachedFile &cached = m_cache[path];
+    cached.contents = contents;
+    cached.triedGzip = false;
+    cached.bytes = contents->size();
+    cached.inode = st.st_ino;
+    cached.size = st.st_size;
+    cached.mtime = st.st_mtim;
+    cached.lruPosition = m_lru.begin();
+    makeRoom(contents->size());
+    m_cacheBytes += contents->size();
+  }
+  pthread_mutex_unlock(&this->m_cacheLock);
+
+  return contents;
+}
+
+shared_ptr<const string> FileService::cachedGzip(string path, shared_ptr<const string> contents) {
+  pthread_mutex_lock(&this->m_cacheLock);
+  unordered_map<string, CachedFile>::iterator iter = m_cache.find(path);
+  if (iter != m_cache.end() && iter->second.contents == contents && iter->second.triedGzip) {
+    shared_ptr<const string> gzipped = iter->second.gzipped;
+    pthread_mutex_unlock(&this->m_cacheLock);
+    return gzipped;
+  }
+  pthread_mutex_unlock(&this->m_cacheLock);
+
+  // compress without holding the lock, it's the slow part
+  shared_ptr<const string> gzipped;
+  string out;
+  if (gzipCompress(*contents, out) && out.size() < contents->size()) {
+    gzipped = make_shared<const string>(out);
+  }
+
+  // the entry may have been replaced or evicted in the meantime, in which
+  // case this copy is just for the one response
+  pthread_mutex_lock(&this->m_cacheLock);
+  iter = m_cache.find(path);
+  if (iter != m_cache.end() && iter->second.contents == contents && !iter->second.triedGzip) {
+    // the entry goes to the front first so making room never evicts it
+    m_lru.splice(m_lru.begin(), m_lru, iter->second.lruPosition);
+    if (gzipped) {
+      makeRoom(gzipped->size());
+      iter->second.bytes += gzipped->size();
+      m_cacheBytes += gzipped->size();
     }
-    response->setBody(fileContents);
+    iter->second.triedGzip = true;
+    iter->second.gzipped = gzipped;
+  }
+  pthread_mutex_unlock(&this->m_cacheLock);
+
+  return gzipped;
+}
+
+void FileService::makeRoom(size_t bytes) {
+  while (m_cacheBytes + bytes > CACHE_CAPACITY && m_lru.size() > 1) {
+    unordered_map<string, CachedFile>::iterator victim = m_cache.find(m_lru.back());
+    m_cacheBytes -= victim->second.bytes;
+    m_cache.erase(victim);
+    m_lru.pop_back();
+  }
+}
+
+int FileService::responseSize(string path) {
+  struct stat st;
+  if (stat((this->m_basedir + path).c_str(), &st) != 0) {
+    // not found, which is a response with an empty body
+    return 0;
   }
+  return st.st_size;
 }
 
 string FileService::readFile(string path) {
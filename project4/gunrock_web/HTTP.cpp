@@ -131,7 +131,12 @@ int HTTP::message_complete_cb(http_parser *parser)
            (http->getState() == HTTP::BODY));
     http->setState(HTTP::DONE);
     http->messageComplete(parser->method);
-    return 0;
+
+    // Stop at the end of this message, anything after it belongs to the
+    // next request on the connection. Stopping leaves out the byte we're
+    // on, which is the last one of this message, so count it ourselves.
+    http->m_extraParsedBytes = 1;
+    return -1;
 }
 
 /****************************************************************************/
@@ -228,6 +233,11 @@ bool HTTP::isDone()
     return m_doneParsing;
 }
 
+bool HTTP::shouldKeepAlive()
+{
+    return http_should_keep_alive(&m_parser);
+}
+
 string HTTP::getReplyHeader()
 {
     string reply;
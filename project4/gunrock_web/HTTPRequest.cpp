@@ -5,6 +5,8 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <strings.h>
 
 #include "HttpUtils.h"
 #include "StringUtils.h"
@@ -52,8 +54,9 @@ string HTTPRequest::getHeader(string key) {
   vector<pair<string *, string *> >::iterator iter;
   vector<pair<string *, string *> > headers = m_http->getHeaders();
   for (iter = headers.begin(); iter != headers.end(); iter++) {
+    // header names are case insensitive
     string header_key = *(iter->first);
-    if (header_key == key) {
+    if (strcasecmp(header_key.c_str(), key.c_str()) == 0) {
       return *(iter->second);
     }
   }
@@ -61,6 +64,71 @@ string HTTPRequest::getHeader(string key) {
   throw "could not find header";
 }
 
+bool HTTPRequest::getRanges(off_t size, vector<pair<off_t, off_t> > &ranges) {
+  // more ranges than this is more likely abuse than a real client
+  const size_t maxRanges = 16;
+
+  string header;
+  try {
+    header = getHeader("Range");
+  } catch (...) {
+    return false;
+  }
+  if (header.compare(0, 6, "bytes=") != 0) {
+    return false;
+  }
+
+  ranges.clear();
+  vector<string> specs = StringUtils::split(header.substr(6), ',');
+  if (specs.empty() || specs.size() > maxRanges) {
+    return false;
+  }
+  for (size_t idx = 0; idx < specs.size(); idx++) {
+    // each one is first-last, first- to the end, or -count for a suffix
+    string spec = specs[idx];
+    spec.erase(0, spec.find_first_not_of(" \t"));
+    spec.erase(spec.find_last_not_of(" \t") + 1);
+    size_t dash = spec.find('-');
+    if (dash == string::npos || spec.find_first_not_of("0123456789-") != string::npos ||
+        spec.find('-', dash + 1) != string::npos) {
+      // a syntax error means we ignore the whole header
+      ranges.clear();
+      return false;
+    }
+    string firstText = spec.substr(0, dash);
+    string lastText = spec.substr(dash + 1);
+
+    off_t first, last;
+    if (firstText.empty()) {
+      if (lastText.empty()) {
+        ranges.clear();
+        return false;
+      }
+      off_t count = strtoll(lastText.c_str(), NULL, 10);
+      if (count == 0) {
+        continue;
+      }
+      first = count < size ? size - count : 0;
+      last = size - 1;
+    } else {
+      first = strtoll(firstText.c_str(), NULL, 10);
+      last = lastText.empty() ? size - 1 : strtoll(lastText.c_str(), NULL, 10);
+      if (!lastText.empty() && last < first) {
+        ranges.clear();
+        return false;
+      }
+      if (last >= size) {
+        last = size - 1;
+      }
+    }
+
+    if (first < size) {
+      ranges.push_back(make_pair(first, last));
+    }
+  }
+  return true;
+}
+
 bool HTTPRequest::hasAuthToken() {
   try {
     getHeader("x-auth-token");
@@ -95,6 +163,29 @@ bool HTTPRequest::readRequest()
     return true;
 }
 
+bool HTTPRequest::readAvailable()
+{
+    // the parser keeps its state between calls, so the request can
+    // arrive in any number of pieces
+    while(!m_http->isDone()) {
+        string readData = m_sock->readNonBlocking();
+        if(readData.empty()) {
+            return false;
+        }
+        onRead(readData.c_str(), readData.size());
+    }
+
+    return true;
+}
+
+bool HTTPRequest::addBufferedData(string data)
+{
+    if(!data.empty()) {
+        onRead(data.c_str(), data.size());
+    }
+    return m_http->isDone();
+}
+
 void HTTPRequest::onRead(const char *buffer, unsigned int len)
 {
     m_totalBytesRead += len;
@@ -105,7 +196,10 @@ void HTTPRequest::onRead(const char *buffer, unsigned int len)
     while(bytesRead < len) {
         assert(!m_http->isDone());
         int ret = m_http->addData((const unsigned char *) (buffer + bytesRead), len - bytesRead);
-        assert(ret > 0);
+        if(ret <= 0) {
+            // not HTTP, drop the client rather than the whole server
+            throw SocketReadError();
+        }
         bytesRead += ret;
         
         // This is a workaround for a parsing bug that sometimes
@@ -115,9 +209,12 @@ void HTTPRequest::onRead(const char *buffer, unsigned int len)
         if(m_http->isDone() && (bytesRead < len)) {
             if(m_http->isConnect() && ((len-bytesRead) == 1) && (buffer[bytesRead] == '\n')) {
                 break;
-            } else {
-                assert(false);
             }
+
+            // the client sent its next request without waiting for our
+            // response, hold on to it for that request
+            m_leftover.append(buffer + bytesRead, len - bytesRead);
+            break;
         }
     }
 }
@@ -1,14 +1,50 @@
-#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 #include "HTTPResponse.h"
 
 using namespace std;
 
+// Shared by every response without a body, so they don't each allocate one
+static shared_ptr<const string> emptyBody() {
+  static const shared_ptr<const string> empty = make_shared<const string>();
+  return empty;
+}
+
+// Appends len bytes to buffer if there's room, and counts them either way
+static void appendBytes(char *buffer, size_t size, size_t &used, const char *data, size_t len) {
+  if (len > 0 && used + len <= size) {
+    memcpy(buffer + used, data, len);
+  }
+  used += len;
+}
+
+static void appendString(char *buffer, size_t size, size_t &used, const string &data) {
+  appendBytes(buffer, size, used, data.data(), data.size());
+}
+
 HTTPResponse::HTTPResponse() {
   this->streaming = false;
   this->contentType = "text/html; charset=ISO-8859-1";
-  this->headers["Server"] = "Gunrock Web";
+  this->headers.push_back(make_pair(string("Server"), string("Gunrock Web")));
   this->status = 200;
+  this->body = emptyBody();
+  this->bodyFd = -1;
+  this->bodyFileOffset = 0;
+  this->bodyFileLength = 0;
+}
+
+HTTPResponse::~HTTPResponse() {
+  closeBodyFile();
+}
+
+void HTTPResponse::closeBodyFile() {
+  if (bodyFd >= 0) {
+    close(bodyFd);
+    bodyFd = -1;
+  }
 }
 
 void HTTPResponse::withStreaming() {
@@ -16,13 +52,32 @@ void HTTPResponse::withStreaming() {
 }
 
 void HTTPResponse::setHeader(string name, string value) {
-  this->headers[name] = value;
+  for (size_t idx = 0; idx < headers.size(); idx++) {
+    if (headers[idx].first == name) {
+      headers[idx].second = value;
+      return;
+    }
+  }
+  headers.push_back(make_pair(name, value));
 }
 
 void HTTPResponse::setBody(string data) {
+  setBody(make_shared<const string>(data));
+}
+
+void HTTPResponse::setBody(shared_ptr<const string> data) {
+  closeBodyFile();
   body = data;
 }
 
+void HTTPResponse::setBodyFile(int fd, off_t offset, size_t length) {
+  closeBodyFile();
+  body = emptyBody();
+  bodyFd = fd;
+  bodyFileOffset = offset;
+  bodyFileLength = length;
+}
+
 int HTTPResponse::getStatus() {
   return status;
 }
@@ -35,34 +90,76 @@ void HTTPResponse::setStatus(int status) {
   this->status = status;
 }
 
-string HTTPResponse::statusToString() {
+const char *HTTPResponse::statusToString() {
   if (status == 200) {
     return "OK";
+  } else if (status == 206) {
+    return "Partial Content";
+  } else if (status == 304) {
+    return "Not Modified";
+  } else if (status == 416) {
+    return "Range Not Satisfiable";
   } else {
     return "Unknown";
   }
 }
 
-string HTTPResponse::response() {
-  stringstream out;
-  setHeader("Content-Type", contentType);
+size_t HTTPResponse::formatHeaders(char *buffer, size_t size) {
+  size_t used = 0;
+  char line[64];
+  int len = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", status, statusToString());
+  appendBytes(buffer, size, used, line, len);
+  for (size_t idx = 0; idx < headers.size(); idx++) {
+    appendString(buffer, size, used, headers[idx].first);
+    appendBytes(buffer, size, used, ": ", 2);
+    appendString(buffer, size, used, headers[idx].second);
+    appendBytes(buffer, size, used, "\r\n", 2);
+  }
+
+  appendBytes(buffer, size, used, "Content-Type: ", 14);
+  appendString(buffer, size, used, contentType);
+  appendBytes(buffer, size, used, "\r\n", 2);
+  // a 304 has no body, so it doesn't get a Content-Length either
   if (streaming) {
-    setHeader("Transfer-Encoding", "chunked");
-  } else {
-    stringstream len;
-    len << body.size();
-    setHeader("Content-Length", len.str());
+    appendBytes(buffer, size, used, "Transfer-Encoding: chunked\r\n", 28);
+  } else if (status != 304) {
+    len = snprintf(line, sizeof(line), "Content-Length: %zu\r\n", bodyFd >= 0 ? bodyFileLength : body->size());
+    appendBytes(buffer, size, used, line, len);
   }
+  appendBytes(buffer, size, used, "\r\n", 2);
+  return used;
+}
 
-  out << "HTTP/1.1 " << status << " " << statusToString() << "\r\n";
-  map<string, string>::iterator iter;
-  for(iter = headers.begin(); iter != headers.end(); iter++) {
-    out << iter->first << ": " << iter->second << "\r\n";
+string HTTPResponse::response() {
+  string out(formatHeaders(NULL, 0), '\0');
+  formatHeaders(&out[0], out.size());
+  if (body->size() > 0 && !streaming) {
+    out += *body;
   }
-  out << "\r\n";
-  if (body.size() > 0 && !streaming) {
-    out << body;
+  return out;
+}
+
+void HTTPResponse::writeTo(MySocket *sock) {
+  char buffer[HEADER_BUFFER_SIZE];
+  string bigHeaders;
+  struct iovec iov[2];
+  iov[0].iov_base = buffer;
+  iov[0].iov_len = formatHeaders(buffer, sizeof(buffer));
+  if (iov[0].iov_len > sizeof(buffer)) {
+    bigHeaders.resize(iov[0].iov_len);
+    formatHeaders(&bigHeaders[0], bigHeaders.size());
+    iov[0].iov_base = &bigHeaders[0];
   }
 
-  return out.str();
+  int count = 1;
+  if (!streaming && bodyFd < 0 && body->size() > 0) {
+    iov[1].iov_base = (void *) body->data();
+    iov[1].iov_len = body->size();
+    count = 2;
+  }
+  sock->writeBuffers(iov, count);
+
+  if (bodyFd >= 0 && !streaming) {
+    sock->sendFile(bodyFd, bodyFileOffset, bodyFileLength);
+  }
 }
@@ -1,13 +1,45 @@
 #include <iostream>
+#include <sstream>
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "HttpService.h"
 #include "ClientError.h"
+#include "StringUtils.h"
 
 using namespace std;
 
+// Formats t as an HTTP date, e.g., "Sun, 06 Nov 1994 08:49:37 GMT"
+static string httpDate(time_t t) {
+  struct tm tm;
+  char buffer[64];
+  gmtime_r(&t, &tm);
+  strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  return buffer;
+}
+
+// Whether an If-None-Match list names etag. This is the weak comparison,
+// so W/"x" matches "x".
+static bool etagListMatches(string list, string etag) {
+  vector<string> candidates = StringUtils::split(list, ',');
+  for (size_t idx = 0; idx < candidates.size(); idx++) {
+    string candidate = candidates[idx];
+    size_t start = candidate.find_first_not_of(" \t");
+    size_t end = candidate.find_last_not_of(" \t");
+    candidate = start == string::npos ? "" : candidate.substr(start, end - start + 1);
+    if (candidate.compare(0, 2, "W/") == 0) {
+      candidate = candidate.substr(2);
+    }
+    if (candidate == "*" || candidate == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
 HttpService::HttpService(string pathPrefix) {
   this->m_pathPrefix = pathPrefix;
 }
@@ -16,6 +48,103 @@ string HttpService::pathPrefix() {
   return m_pathPrefix;
 }
 
+int HttpService::responseSize(string path) {
+  return -1;
+}
+
+bool HttpService::checkNotModified(HTTPRequest *request, HTTPResponse *response,
+                                   string etag, time_t lastModified) {
+  response->setHeader("ETag", etag);
+  if (lastModified != 0) {
+    response->setHeader("Last-Modified", httpDate(lastModified));
+  }
+
+  bool isCurrent = false;
+  try {
+    // If-None-Match wins when the client sends both
+    isCurrent = etagListMatches(request->getHeader("If-None-Match"), etag);
+  } catch (...) {
+    try {
+      string since = request->getHeader("If-Modified-Since");
+      struct tm tm;
+      memset(&tm, 0, sizeof(tm));
+      const char *end = strptime(since.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+      isCurrent = lastModified != 0 && end != NULL && lastModified <= timegm(&tm);
+    } catch (...) {
+      // no conditional headers
+    }
+  }
+
+  if (isCurrent) {
+    response->setStatus(304);
+    response->setBody("");
+  }
+  return isCurrent;
+}
+
+vector<pair<off_t, off_t> > HttpService::requestedRanges(HTTPRequest *request, HTTPResponse *response,
+                                                          off_t size, string etag) {
+  vector<pair<off_t, off_t> > ranges;
+  response->setHeader("Accept-Ranges", "bytes");
+  if (!request->getRanges(size, ranges)) {
+    return vector<pair<off_t, off_t> >();
+  }
+
+  // If-Range asks for the ranges only if the client's copy is this
+  // version, and for the whole body otherwise
+  try {
+    if (request->getHeader("If-Range") != etag) {
+      return vector<pair<off_t, off_t> >();
+    }
+  } catch (...) {
+    // no If-Range
+  }
+
+  if (ranges.empty()) {
+    stringstream unsatisfied;
+    unsatisfied << "bytes */" << size;
+    response->setHeader("Content-Range", unsatisfied.str());
+    throw ClientError::rangeNotSatisfiable();
+  }
+  return ranges;
+}
+
+string HttpService::contentRange(pair<off_t, off_t> range, off_t size) {
+  stringstream out;
+  out << "bytes " << range.first << "-" << range.second << "/" << size;
+  return out.str();
+}
+
+void HttpService::setPartialBody(HTTPResponse *response, const vector<pair<off_t, off_t> > &ranges,
+                                 const vector<string> &parts, off_t size) {
+  response->setStatus(206);
+  if (ranges.size() == 1) {
+    response->setHeader("Content-Range", contentRange(ranges[0], size));
+    response->setBody(parts[0]);
+    return;
+  }
+
+  // each part gets its own Content-Type and Content-Range headers, and the
+  // response as a whole is multipart
+  string boundary = "gunrock_byteranges";
+  for (size_t idx = 0; idx < parts.size(); idx++) {
+    // the boundary can't appear in the data
+    while (parts[idx].find(boundary) != string::npos) {
+      boundary += "_";
+    }
+  }
+  string body;
+  for (size_t idx = 0; idx < ranges.size(); idx++) {
+    body += "\r\n--" + boundary + "\r\n";
+    body += "Content-Type: " + response->getContentType() + "\r\n";
+    body += "Content-Range: " + contentRange(ranges[idx], size) + "\r\n\r\n";
+    body += parts[idx];
+  }
+  body += "\r\n--" + boundary + "--\r\n";
+  response->setContentType("multipart/byteranges; boundary=" + boundary);
+  response->setBody(body);
+}
+
 void HttpService::head(HTTPRequest *request, HTTPResponse *response) {
   cout << "HEAD " << request->getPath() << endl;
   throw ClientError::methodNotAllowed();
@@ -2,30 +2,331 @@
 #include <string>
 #include <cstring>
 #include <vector>
+#include <algorithm>
 #include <assert.h>
 
 #include "LocalFileSystem.h"
+#include "Bitmap.h"
+#include "StringUtils.h"
 #include "ufs.h"
 
 using namespace std;
 
-LocalFileSystem::LocalFileSystem(Disk *disk)
+// How many directories keep a hash index in memory at once
+static const size_t DIRECTORY_INDEX_LIMIT = 1024;
+// How many path components the dentry cache remembers
+static const size_t DENTRY_CACHE_LIMIT = 65536;
+
+namespace
+{
+// Hold a lock for the rest of the scope, so the early returns in the
+// operations below can't leak it
+class ScopedMutex
+{
+public:
+  ScopedMutex(pthread_mutex_t *mutex) : mutex(mutex)
+  {
+    pthread_mutex_lock(mutex);
+  }
+  ~ScopedMutex()
+  {
+    pthread_mutex_unlock(mutex);
+  }
+
+private:
+  pthread_mutex_t *mutex;
+};
+
+// An inode lock, a NULL lock (for an invalid inode number) is ignored
+class ScopedRwLock
+{
+public:
+  ScopedRwLock(pthread_rwlock_t *lock, bool exclusive) : lock(lock)
+  {
+    if (lock != NULL && exclusive)
+    {
+      pthread_rwlock_wrlock(lock);
+    }
+    else if (lock != NULL)
+    {
+      pthread_rwlock_rdlock(lock);
+    }
+  }
+  ~ScopedRwLock()
+  {
+    if (lock != NULL)
+    {
+      pthread_rwlock_unlock(lock);
+    }
+  }
+
+private:
+  pthread_rwlock_t *lock;
+};
+
+// Run a writing operation as a transaction of its own, unless the caller
+// already has one open that it will commit or roll back itself
+class ScopedTransaction
+{
+public:
+  ScopedTransaction(Disk *disk) : disk(disk), isOwnTransaction(!disk->ownsTransaction())
+  {
+    if (isOwnTransaction)
+    {
+      disk->beginTransaction();
+    }
+  }
+  ~ScopedTransaction()
+  {
+    if (isOwnTransaction)
+    {
+      disk->commit();
+    }
+  }
+
+private:
+  Disk *disk;
+  bool isOwnTransaction;
+};
+}
+
+static int blocksForSize(int size)
+{
+  int blocks = size / UFS_BLOCK_SIZE;
+  if ((size % UFS_BLOCK_SIZE) != 0)
+  {
+    blocks += 1;
+  }
+  return blocks;
+}
+
+LocalFileSystem::LocalFileSystem(Disk *disk, int cacheBlocks)
 {
   this->disk = disk;
+  this->cache = new BufferCache(disk, cacheBlocks);
+  this->allocationPolicy = FIRST_FIT;
+  pthread_mutex_init(&inodeBitmapLock, NULL);
+  pthread_mutex_init(&dataBitmapLock, NULL);
+  pthread_mutex_init(&inodeTableLock, NULL);
+  pthread_mutex_init(&indexLock, NULL);
+  pthread_mutex_init(&dentryLock, NULL);
+  loadSuperBlock();
+
+  // Replays anything left in the journal and routes commits through it.
+  // Images made without a journal have journal_len 0.
+  if (superBlock.journal_len > 0)
+  {
+    disk->attachJournal(superBlock.journal_addr, superBlock.journal_len);
+  }
 }
 
-void LocalFileSystem::readSuperBlock(super_t *super)
+LocalFileSystem::~LocalFileSystem()
+{
+  for (size_t idx = 0; idx < inodeLocks.size(); idx++)
+  {
+    pthread_rwlock_destroy(&inodeLocks[idx]);
+  }
+  pthread_mutex_destroy(&inodeBitmapLock);
+  pthread_mutex_destroy(&dataBitmapLock);
+  pthread_mutex_destroy(&inodeTableLock);
+  pthread_mutex_destroy(&indexLock);
+  pthread_mutex_destroy(&dentryLock);
+  delete cache;
+}
+
+void LocalFileSystem::loadSuperBlock()
 {
   char buffer[UFS_BLOCK_SIZE];
-  disk->readBlock(0, buffer);
-  memcpy(super, buffer, sizeof(super_t));
+  cache->readBlock(0, buffer);
+  memcpy(&superBlock, buffer, sizeof(super_t));
+
+  inodesPerBlock = UFS_BLOCK_SIZE / sizeof(inode_t);
+  // The bitmaps are read and written as whole blocks
+  inodeBitmapBytes = superBlock.inode_bitmap_len * UFS_BLOCK_SIZE;
+  dataBitmapBytes = superBlock.data_bitmap_len * UFS_BLOCK_SIZE;
+  hasIndirectBlocks = (superBlock.features & UFS_FEATURE_INDIRECT) != 0;
+  hasInlineData = (superBlock.features & UFS_FEATURE_INLINE_DATA) != 0;
+
+  for (size_t idx = 0; idx < inodeLocks.size(); idx++)
+  {
+    pthread_rwlock_destroy(&inodeLocks[idx]);
+  }
+  inodeLocks.assign(max(superBlock.num_inodes, 0), pthread_rwlock_t());
+  for (size_t idx = 0; idx < inodeLocks.size(); idx++)
+  {
+    pthread_rwlock_init(&inodeLocks[idx], NULL);
+  }
+
+  inodeHint = 0;
+  dataHint = 0;
+  directoryIndexes.clear();
+  touchedDirectories.clear();
+  dentries.clear();
+  dentryCount = 0;
+  seenRollbacks = disk->rollbacks();
+  seenCommits = disk->commits();
+}
+
+void LocalFileSystem::checkRollbacks()
+{
+  // A rollback can undo allocations below the hints, directory changes
+  // we already applied to the indexes, and blocks that were read into the
+  // cache while the transaction was open, so start over
+  unsigned int rollbacks = disk->rollbacks();
+  unsigned int commits = disk->commits();
+  if (rollbacks == seenRollbacks && commits == seenCommits)
+  {
+    return;
+  }
+  if (rollbacks == seenRollbacks)
+  {
+    // What the committed transaction did to the directories it touched is
+    // now what every thread reads, so its indexes can be shared
+    ScopedMutex indexGuard(&indexLock);
+    if (commits == seenCommits)
+    {
+      return; // another thread got here first
+    }
+    for (unordered_map<int, shared_ptr<DirectoryIndex> >::iterator touched = touchedDirectories.begin();
+         touched != touchedDirectories.end(); touched++)
+    {
+      if (touched->second)
+      {
+        if (directoryIndexes.size() >= DIRECTORY_INDEX_LIMIT)
+        {
+          directoryIndexes.erase(directoryIndexes.begin());
+        }
+        directoryIndexes[touched->first] = touched->second;
+      }
+    }
+    touchedDirectories.clear();
+    seenCommits = commits;
+    return;
+  }
+
+  ScopedMutex inodeBitmapGuard(&inodeBitmapLock);
+  ScopedMutex dataBitmapGuard(&dataBitmapLock);
+  inodeHint = 0;
+  dataHint = 0;
+  cache->invalidateAll();
+  {
+    ScopedMutex indexGuard(&indexLock);
+    directoryIndexes.clear();
+    touchedDirectories.clear();
+    seenCommits = commits;
+  }
+  {
+    ScopedMutex dentryGuard(&dentryLock);
+    dentries.clear();
+    dentryCount = 0;
+  }
+  seenRollbacks = rollbacks;
+}
+
+pthread_rwlock_t *LocalFileSystem::inodeLock(int inodeNumber)
+{
+  if (inodeNumber < 0 || inodeNumber >= (int)inodeLocks.size())
+  {
+    return NULL;
+  }
+  return &inodeLocks[inodeNumber];
+}
+
+shared_ptr<LocalFileSystem::DirectoryIndex> LocalFileSystem::directoryIndex(int inodeNumber, inode_t *inode)
+{
+  // Until the transaction that touched a directory commits, its index is
+  // only for the thread in the transaction
+  bool isOwner = disk->ownsTransaction();
+  {
+    ScopedMutex indexGuard(&indexLock);
+    unordered_map<int, shared_ptr<DirectoryIndex> >::iterator touched = touchedDirectories.find(inodeNumber);
+    if (touched != touchedDirectories.end())
+    {
+      if (isOwner && touched->second)
+      {
+        return touched->second;
+      }
+    }
+    else
+    {
+      unordered_map<int, shared_ptr<DirectoryIndex> >::iterator iter = directoryIndexes.find(inodeNumber);
+      if (iter != directoryIndexes.end())
+      {
+        return iter->second;
+      }
+    }
+  }
+
+  // Build the index from the directory contents the first time we need
+  // it. The caller holds the directory's inode lock, so the directory
+  // can't change while we read it, but another thread's transaction can
+  // still commit or roll back what we read.
+  unsigned int rollbacks = disk->rollbacks();
+  unsigned int commits = disk->commits();
+  shared_ptr<DirectoryIndex> index = make_shared<DirectoryIndex>();
+  index->entries.resize(inode->size / sizeof(dir_ent_t));
+  readRange(inodeNumber, index->entries.data(), inode->size, 0);
+  for (size_t slot = 0; slot < index->entries.size(); slot++)
+  {
+    dir_ent_t &entry = index->entries[slot];
+    if (entry.inum != -1)
+    {
+      // if a name shows up twice, the first one wins, like a linear scan
+      index->slots.emplace(string(entry.name, strnlen(entry.name, DIR_ENT_NAME_SIZE)), slot);
+    }
+  }
+
+  ScopedMutex indexGuard(&indexLock);
+  if (disk->rollbacks() != rollbacks || disk->commits() != commits)
+  {
+    return index;
+  }
+  unordered_map<int, shared_ptr<DirectoryIndex> >::iterator touched = touchedDirectories.find(inodeNumber);
+  if (touched != touchedDirectories.end())
+  {
+    // the transaction's own view, or the committed one that it's replacing
+    if (isOwner)
+    {
+      touched->second = index;
+    }
+    return index;
+  }
+  if (directoryIndexes.size() >= DIRECTORY_INDEX_LIMIT)
+  {
+    directoryIndexes.erase(directoryIndexes.begin());
+  }
+  // Another reader of the directory may have built it first
+  return directoryIndexes.emplace(inodeNumber, index).first->second;
+}
+
+void LocalFileSystem::touchDirectory(int inodeNumber, shared_ptr<DirectoryIndex> index)
+{
+  ScopedMutex indexGuard(&indexLock);
+  directoryIndexes.erase(inodeNumber);
+  touchedDirectories[inodeNumber] = index;
+}
+
+void LocalFileSystem::setAllocationPolicy(AllocationPolicy policy)
+{
+  allocationPolicy = policy;
+}
+
+void LocalFileSystem::readSuperBlock(super_t *super)
+{
+  *super = superBlock;
+}
+
+void LocalFileSystem::invalidateSuperBlock()
+{
+  cache->invalidateAll();
+  loadSuperBlock();
 }
 
 void LocalFileSystem::readInodeBitmap(super_t *super, unsigned char *inodeBitmap)
 {
   for (int block_num = 0; block_num < super->inode_bitmap_len; block_num++)
   {
-    disk->readBlock(super->inode_bitmap_addr + block_num, inodeBitmap + (block_num * UFS_BLOCK_SIZE));
+    cache->readBlock(super->inode_bitmap_addr + block_num, inodeBitmap + (block_num * UFS_BLOCK_SIZE));
   }
 }
 
@@ -33,7 +334,7 @@ void LocalFileSystem::writeInodeBitmap(super_t *super, unsigned char *inodeBitma
 {
   for (int block_num = 0; block_num < super->inode_bitmap_len; block_num++)
   {
-    disk->writeBlock(super->inode_bitmap_addr + block_num, inodeBitmap + (block_num * UFS_BLOCK_SIZE));
+    cache->writeBlock(super->inode_bitmap_addr + block_num, inodeBitmap + (block_num * UFS_BLOCK_SIZE));
   }
 }
 
@@ -41,7 +342,7 @@ void LocalFileSystem::readDataBitmap(super_t *super, unsigned char *dataBitmap)
 {
   for (int block_num = 0; block_num < super->data_bitmap_len; block_num++)
   {
-    disk->readBlock(super->data_bitmap_addr + block_num, dataBitmap + (block_num * UFS_BLOCK_SIZE));
+    cache->readBlock(super->data_bitmap_addr + block_num, dataBitmap + (block_num * UFS_BLOCK_SIZE));
   }
 }
 
@@ -49,7 +350,7 @@ void LocalFileSystem::writeDataBitmap(super_t *super, unsigned char *dataBitmap)
 {
   for (int block_num = 0; block_num < super->data_bitmap_len; block_num++)
   {
-    disk->writeBlock(super->data_bitmap_addr + block_num, dataBitmap + (block_num * UFS_BLOCK_SIZE));
+    cache->writeBlock(super->data_bitmap_addr + block_num, dataBitmap + (block_num * UFS_BLOCK_SIZE));
   }
 }
 
@@ -58,7 +359,7 @@ void LocalFileSystem::readInodeRegion(super_t *super, inode_t *inodes)
   int inodes_per_block = UFS_BLOCK_SIZE / sizeof(inode_t);
   for (int block_num = 0; block_num < super->inode_region_len; block_num++)
   {
-    disk->readBlock(super->inode_region_addr + block_num, inodes + inodes_per_block * block_num);
+    cache->readBlock(super->inode_region_addr + block_num, inodes + inodes_per_block * block_num);
   }
 }
 
@@ -67,72 +368,190 @@ void LocalFileSystem::writeInodeRegion(super_t *super, inode_t *inodes)
   int inodes_per_block = UFS_BLOCK_SIZE / sizeof(inode_t);
   for (int block_num = 0; block_num < super->inode_region_len; block_num++)
   {
-    disk->writeBlock(super->inode_region_addr + block_num, inodes + inodes_per_block * block_num);
+    cache->writeBlock(super->inode_region_addr + block_num, inodes + inodes_per_block * block_num);
   }
 }
 
+void LocalFileSystem::readInode(int inodeNumber, inode_t *inode)
+{
+  char blockBuffer[UFS_BLOCK_SIZE];
+  cache->readBlock(superBlock.inode_region_addr + inodeNumber / inodesPerBlock, blockBuffer);
+  memcpy(inode, blockBuffer + (inodeNumber % inodesPerBlock) * sizeof(inode_t), sizeof(inode_t));
+}
+
+void LocalFileSystem::writeInode(int inodeNumber, inode_t *inode)
+{
+  // Other inodes share this block, so always start from its current contents
+  char blockBuffer[UFS_BLOCK_SIZE];
+  int blockNumber = superBlock.inode_region_addr + inodeNumber / inodesPerBlock;
+  ScopedMutex inodeTableGuard(&inodeTableLock);
+  cache->readBlock(blockNumber, blockBuffer);
+  memcpy(blockBuffer + (inodeNumber % inodesPerBlock) * sizeof(inode_t), inode, sizeof(inode_t));
+  cache->writeBlock(blockNumber, blockBuffer);
+}
+
+bool LocalFileSystem::isInodeAllocated(int inodeNumber)
+{
+  // Only read the bitmap block that holds this inode's bit
+  int bitsPerBlock = UFS_BLOCK_SIZE * 8;
+  unsigned char blockBuffer[UFS_BLOCK_SIZE];
+  cache->readBlock(superBlock.inode_bitmap_addr + inodeNumber / bitsPerBlock, blockBuffer);
+  return Bitmap(blockBuffer, bitsPerBlock).isSet(inodeNumber % bitsPerBlock);
+}
+
 int LocalFileSystem::lookup(int parentInodeNumber, string name)
 {
-  super_t super;
-  readSuperBlock(&super);
+  checkRollbacks();
+  ScopedRwLock parentLock(inodeLock(parentInodeNumber), false);
+  return lookupEntry(parentInodeNumber, name);
+}
 
+int LocalFileSystem::lookupEntry(int parentInodeNumber, const string &name)
+{
   // Get the parent inode
-  inode_t parentinode;
-  int statResult = this->stat(parentInodeNumber, &parentinode);
-  if (statResult != 0)
+  inode_t parentInode;
+  if (this->stat(parentInodeNumber, &parentInode) != 0)
   {
-    return -EINVALIDINODE; // Return error from stat if it fails
+    return -EINVALIDINODE;
   }
 
   // Check if the parent inode is a directory
-  if (parentinode.type != UFS_DIRECTORY)
+  if (parentInode.type != UFS_DIRECTORY)
   {
     return -EINVALIDINODE;
   }
 
-  // Read the contents of the parent inode
-  char buffer[parentinode.size];
-  int readBytes = this->read(parentInodeNumber, buffer, parentinode.size);
-  if (readBytes < 0)
+  // Look the name up in the directory's hash index
+  shared_ptr<DirectoryIndex> index = directoryIndex(parentInodeNumber, &parentInode);
+  unordered_map<string, int>::iterator slot = index->slots.find(name);
+  if (slot == index->slots.end())
   {
-    return -EINVALIDINODE; // Failed to read
+    return -ENOTFOUND; // Entry not found
+  }
+
+  return index->entries[slot->second].inum;
+}
+
+int LocalFileSystem::lookupDentry(int parentInodeNumber, const string &name, Dentry *dentry)
+{
+  {
+    ScopedMutex dentryGuard(&dentryLock);
+    unordered_map<int, unordered_map<string, Dentry> >::iterator directory = dentries.find(parentInodeNumber);
+    if (directory != dentries.end())
+    {
+      unordered_map<string, Dentry>::iterator cached = directory->second.find(name);
+      if (cached != directory->second.end())
+      {
+        *dentry = cached->second;
+        return 0;
+      }
+    }
   }
 
-  int offset = 0;
-  // Iterate through the directory entries
-  while (offset < readBytes)
+  // Keep the directory locked until the answer is cached, so a create or
+  // unlink can't slip in between and leave a stale entry behind
+  ScopedRwLock parentLock(inodeLock(parentInodeNumber), false);
+  unsigned int rollbacks = disk->rollbacks();
+  unsigned int commits = disk->commits();
+  int inodeNumber = lookupEntry(parentInodeNumber, name);
+  if (inodeNumber == -ENOTFOUND)
+  {
+    dentry->inodeNumber = -ENOTFOUND;
+    dentry->type = -1;
+  }
+  else if (inodeNumber < 0)
+  {
+    return inodeNumber;
+  }
+  else
   {
-    dir_ent_t *entry = reinterpret_cast<dir_ent_t *>(buffer + offset);
-    // Check if the entry is valid and matches the name
-    if (entry->inum != -1 && strcmp(entry->name, name.c_str()) == 0)
+    inode_t inode;
+    if (this->stat(inodeNumber, &inode) != 0)
     {
-      return entry->inum; // Found the entry, return the inode number
+      return -EINVALIDINODE;
     }
-    offset += sizeof(dir_ent_t); // Move to the next entry
+    dentry->inodeNumber = inodeNumber;
+    dentry->type = inode.type;
   }
 
-  return -ENOTFOUND; // Entry not found
+  {
+    // the answer may not be what other threads read once the open
+    // transaction commits, see touchDirectory
+    ScopedMutex indexGuard(&indexLock);
+    if (touchedDirectories.count(parentInodeNumber) > 0)
+    {
+      return 0;
+    }
+  }
+  ScopedMutex dentryGuard(&dentryLock);
+  if (disk->rollbacks() != rollbacks || disk->commits() != commits)
+  {
+    return 0; // the answer may come from writes that were just undone or committed
+  }
+  if (dentryCount >= DENTRY_CACHE_LIMIT)
+  {
+    dentries.clear();
+    dentryCount = 0;
+  }
+  dentries[parentInodeNumber][name] = *dentry;
+  dentryCount++;
+  return 0;
 }
 
-int LocalFileSystem::stat(int inodeNumber, inode_t *inode)
+void LocalFileSystem::invalidateDentry(int parentInodeNumber, const string &name)
 {
-  super_t super;
-  readSuperBlock(&super); // Read for layout info
+  ScopedMutex dentryGuard(&dentryLock);
+  unordered_map<int, unordered_map<string, Dentry> >::iterator directory = dentries.find(parentInodeNumber);
+  if (directory != dentries.end())
+  {
+    dentryCount -= directory->second.erase(name);
+  }
+}
 
-  if (inodeNumber < 0 || inodeNumber >= super.num_inodes)
+int LocalFileSystem::resolvePath(string path)
+{
+  if (path.empty() || path[0] != '/')
   {
-    return -EINVALIDINODE;
+    return -ENOTFOUND;
   }
 
-  int inodesPerBlock = UFS_BLOCK_SIZE / sizeof(inode_t);
-  int blockNumber = super.inode_region_addr + (inodeNumber / inodesPerBlock);
-  int offsetInBlock = (inodeNumber % inodesPerBlock) * sizeof(inode_t);
+  checkRollbacks();
+  vector<string> components = StringUtils::split(path, '/');
+  int inodeNumber = UFS_ROOT_DIRECTORY_INODE_NUMBER;
+  int type = UFS_DIRECTORY;
+  for (size_t idx = 0; idx < components.size(); idx++)
+  {
+    if (type != UFS_DIRECTORY)
+    {
+      return -EINVALIDINODE;
+    }
+
+    Dentry dentry;
+    int ret = lookupDentry(inodeNumber, components[idx], &dentry);
+    if (ret < 0)
+    {
+      return ret;
+    }
+    if (dentry.inodeNumber < 0)
+    {
+      return dentry.inodeNumber;
+    }
+    inodeNumber = dentry.inodeNumber;
+    type = dentry.type;
+  }
 
-  vector<unsigned char> blockBuffer(UFS_BLOCK_SIZE);
+  return inodeNumber;
+}
 
-  this->disk->readBlock(blockNumber, blockBuffer.data());
+int LocalFileSystem::stat(int inodeNumber, inode_t *inode)
+{
+  checkRollbacks();
+  if (inodeNumber < 0 || inodeNumber >= superBlock.num_inodes || !isInodeAllocated(inodeNumber))
+  {
+    return -EINVALIDINODE;
+  }
 
-  memcpy(inode, blockBuffer.data() + offsetInBlock, sizeof(inode_t));
+  readInode(inodeNumber, inode);
 
   if (inode->type != UFS_DIRECTORY && inode->type != UFS_REGULAR_FILE)
   {
@@ -142,486 +561,913 @@ int LocalFileSystem::stat(int inodeNumber, inode_t *inode)
   return 0;
 }
 
+int LocalFileSystem::blockNumbers(int inodeNumber, vector<int> *blockNumbers)
+{
+  checkRollbacks();
+  ScopedRwLock lock(inodeLock(inodeNumber), false);
+  inode_t inode;
+  if (this->stat(inodeNumber, &inode) != 0)
+  {
+    return -EINVALIDINODE;
+  }
+
+  blockNumbers->clear();
+  mapBlocks(&inode, 0, blocksInUse(&inode), blockNumbers);
+  return 0;
+}
+
+bool LocalFileSystem::isInline(int inodeNumber)
+{
+  inode_t inode;
+  return this->stat(inodeNumber, &inode) == 0 && fitsInline(&inode, inode.size);
+}
+
+bool LocalFileSystem::fitsInline(inode_t *inode, int size)
+{
+  return hasInlineData && inode->type == UFS_REGULAR_FILE && size <= INLINE_DATA_SIZE;
+}
+
+int LocalFileSystem::blocksInUse(inode_t *inode)
+{
+  return fitsInline(inode, inode->size) ? 0 : blocksForSize(inode->size);
+}
+
+int LocalFileSystem::maxFileSize()
+{
+  return hasIndirectBlocks ? MAX_INDIRECT_FILE_SIZE : MAX_FILE_SIZE;
+}
+
 int LocalFileSystem::read(int inodeNumber, void *buffer, int size)
 {
-  // If the size is invalid , return an error
-  if (size < 0)
+  return this->pread(inodeNumber, buffer, size, 0);
+}
+
+int LocalFileSystem::pread(int inodeNumber, void *buffer, int size, int offset)
+{
+  checkRollbacks();
+  ScopedRwLock lock(inodeLock(inodeNumber), false);
+  return readRange(inodeNumber, buffer, size, offset);
+}
+
+int LocalFileSystem::readRange(int inodeNumber, void *buffer, int size, int offset)
+{
+  // If the size or offset is invalid, return an error
+  if (size < 0 || offset < 0)
   {
     return -EINVALIDSIZE;
   }
 
-  // Check for the existence of the inode
-  super_t super;
-  readSuperBlock(&super);
-  if (inodeNumber < 0 || inodeNumber >= super.num_inodes)
+  inode_t inode;
+  if (this->stat(inodeNumber, &inode) != 0)
   {
     return -EINVALIDINODE;
   }
 
-  int inodesPerBlock = UFS_BLOCK_SIZE / sizeof(inode_t);
-
-  // Calculate the block number and offset within the block for the inode
-  int blockNumber = super.inode_region_addr + (inodeNumber / inodesPerBlock);
-  int offsetInBlock = (inodeNumber % inodesPerBlock) * sizeof(inode_t);
-
-  // Read the block containing the inode
-  vector<unsigned char> blockBuffer(UFS_BLOCK_SIZE);
-  this->disk->readBlock(blockNumber, blockBuffer.data());
+  if (offset >= inode.size)
+  {
+    return 0;
+  }
+  int bytesToRead = min(size, inode.size - offset);
+  int end = offset + bytesToRead;
+  char *data = static_cast<char *>(buffer);
 
-  // Copy the inode data from the block buffer
-  inode_t inode;
-  memcpy(&inode, blockBuffer.data() + offsetInBlock, sizeof(inode_t));
+  if (fitsInline(&inode, inode.size))
+  {
+    memcpy(data, reinterpret_cast<char *>(inode.direct) + offset, bytesToRead);
+    return bytesToRead;
+  }
 
-  // Check if the inode is valid
-  if (inode.type != UFS_DIRECTORY && inode.type != UFS_REGULAR_FILE)
+  // Whole blocks go straight into the caller's buffer, only the partial
+  // blocks at either end are read into a block buffer and copied
+  char partialBlocks[2][UFS_BLOCK_SIZE];
+  int numPartial = 0;
+  int firstBlock = offset / UFS_BLOCK_SIZE;
+  vector<int> blockNumbers;
+  mapBlocks(&inode, firstBlock, blocksForSize(end) - firstBlock, &blockNumbers);
+  vector<pair<int, void *> > blocks;
+  for (int blockIndex = firstBlock; blockIndex * UFS_BLOCK_SIZE < end; blockIndex++)
   {
-    return -EINVALIDINODE;
+    int blockStart = blockIndex * UFS_BLOCK_SIZE;
+    bool isPartial = blockStart < offset || blockStart + UFS_BLOCK_SIZE > end;
+    void *target = isPartial ? (void *)partialBlocks[numPartial++] : (void *)(data + blockStart - offset);
+    blocks.push_back(make_pair(blockNumbers[blockIndex - firstBlock], target));
   }
 
-  // Read the data blocks associated with the inode
-  int bytesRead = 0;
-  int bytesToRead = min(size, inode.size);
-  int blockIndex = 0;
+  // Directory contents are metadata and go through the cache
+  if (inode.type == UFS_DIRECTORY)
+  {
+    for (size_t idx = 0; idx < blocks.size(); idx++)
+    {
+      cache->readBlock(blocks[idx].first, blocks[idx].second);
+    }
+  }
+  else
+  {
+    this->disk->readBlocks(blocks);
+  }
 
-  while (bytesRead < bytesToRead && blockIndex < DIRECT_PTRS)
+  numPartial = 0;
+  for (size_t idx = 0; idx < blocks.size(); idx++)
   {
-    if (inode.direct[blockIndex] == 0)
+    if (blocks[idx].second == partialBlocks[numPartial])
     {
-      break; // No more data blocks
+      int blockStart = (offset / UFS_BLOCK_SIZE + idx) * UFS_BLOCK_SIZE;
+      int copyStart = max(offset, blockStart);
+      int copyEnd = min(end, blockStart + UFS_BLOCK_SIZE);
+      memcpy(data + copyStart - offset, partialBlocks[numPartial] + (copyStart - blockStart), copyEnd - copyStart);
+      numPartial++;
     }
+  }
 
-    // Read the data block
-    this->disk->readBlock(inode.direct[blockIndex], blockBuffer.data());
+  return bytesToRead;
+}
 
-    // Calculate the number of bytes to copy from this block
-    int bytesInBlock = min(UFS_BLOCK_SIZE, bytesToRead - bytesRead);
+unsigned int *LocalFileSystem::pointerBlock(int blockNumber, PointerBlocks *pointers)
+{
+  map<int, vector<unsigned int> >::iterator iter = pointers->blocks.find(blockNumber);
+  if (iter == pointers->blocks.end())
+  {
+    // Pointer blocks are metadata and go through the cache
+    iter = pointers->blocks.insert(make_pair(blockNumber, vector<unsigned int>(PTRS_PER_BLOCK))).first;
+    cache->readBlock(blockNumber, iter->second.data());
+  }
+  return iter->second.data();
+}
 
-    // Copy the data from the block buffer to the output buffer
-    memcpy(static_cast<char *>(buffer) + bytesRead, blockBuffer.data(), bytesInBlock);
+void LocalFileSystem::writePointerBlocks(PointerBlocks *pointers)
+{
+  vector<pair<int, const void *> > blocks;
+  for (set<int>::iterator iter = pointers->dirty.begin(); iter != pointers->dirty.end(); iter++)
+  {
+    blocks.push_back(make_pair(*iter, (const void *)pointers->blocks[*iter].data()));
+  }
+  cache->writeBlocks(blocks);
+  pointers->dirty.clear();
+}
 
-    bytesRead += bytesInBlock;
-    blockIndex++;
+unsigned int *LocalFileSystem::blockSlot(inode_t *inode, int blockIndex, PointerBlocks *pointers, int *pointerBlockNumber)
+{
+  if (!hasIndirectBlocks || blockIndex < NUM_DIRECT)
+  {
+    *pointerBlockNumber = -1;
+    return &inode->direct[blockIndex];
   }
 
-  return bytesRead;
+  blockIndex -= NUM_DIRECT;
+  int indirectBlock = inode->direct[INDIRECT_PTR];
+  if (blockIndex >= PTRS_PER_BLOCK)
+  {
+    blockIndex -= PTRS_PER_BLOCK;
+    indirectBlock = pointerBlock(inode->direct[DOUBLE_INDIRECT_PTR], pointers)[blockIndex / PTRS_PER_BLOCK];
+    blockIndex %= PTRS_PER_BLOCK;
+  }
+  *pointerBlockNumber = indirectBlock;
+  return &pointerBlock(indirectBlock, pointers)[blockIndex];
 }
 
-int LocalFileSystem::create(int parentInodeNumber, int type, string name)
+void LocalFileSystem::mapBlocks(inode_t *inode, int firstBlock, int numBlocks, vector<int> *blockNumbers)
 {
-  /**
-   * Write the contents of a file.
-   *
-   * Writes a buffer of size to the file, replacing any content that
-   * already exists.
-   *
-   * Success: number of bytes written
-   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -EINVALIDTYPE.
-   * Failure modes: invalid inodeNumber, invalid size, not a regular file
-   * (because you can't write to directories).
-   */
-  // 1. Validate `name`
-  if (name.empty() || name.length() >= DIR_ENT_NAME_SIZE)
+  PointerBlocks pointers;
+  int pointerBlockNumber;
+  for (int blockIndex = firstBlock; blockIndex < firstBlock + numBlocks; blockIndex++)
   {
-    return -EINVALIDNAME; // Invalid name length
+    blockNumbers->push_back(*blockSlot(inode, blockIndex, &pointers, &pointerBlockNumber));
   }
+}
 
-  // 2. Validate `type`
-  if (type != UFS_REGULAR_FILE && type != UFS_DIRECTORY)
+int LocalFileSystem::allocateBlock(Bitmap *dataBits, int *runStart)
+{
+  int freeBlock;
+  if (*runStart >= 0)
   {
-    return -EINVALIDTYPE; // Invalid type
+    // The run was checked up front, and it need not start at the hint,
+    // so the hint stays where it is
+    freeBlock = (*runStart)++;
   }
+  else
+  {
+    freeBlock = dataBits->findFree(dataHint);
+    if (freeBlock < 0)
+    {
+      dataHint = superBlock.num_data;
+      return -1;
+    }
+    dataHint = freeBlock + 1;
+  }
+  dataBits->set(freeBlock);
+  return superBlock.data_region_addr + freeBlock;
+}
 
-  // 3. Read the superblock
-  super_t super;
-  char superBlockBuffer[UFS_BLOCK_SIZE];
-  disk->readBlock(0, superBlockBuffer);
-  memcpy(&super, superBlockBuffer, sizeof(super_t));
+void LocalFileSystem::releaseBlock(int blockNumber, Bitmap *dataBits, PointerBlocks *pointers)
+{
+  int freedBlock = blockNumber - superBlock.data_region_addr;
+  dataBits->clear(freedBlock);
+  dataHint = min(dataHint, freedBlock);
+  pointers->blocks.erase(blockNumber);
+  pointers->dirty.erase(blockNumber);
+}
 
-  // 4. Validate `parentInodeNumber`
-  if (parentInodeNumber < 0 || parentInodeNumber >= super.num_inodes)
+int LocalFileSystem::pointerBlocksFor(int numBlocks)
+{
+  if (!hasIndirectBlocks || numBlocks <= NUM_DIRECT)
   {
-    return -EINVALIDINODE; // Out of bounds
+    return 0;
   }
+  if (numBlocks <= NUM_DIRECT + PTRS_PER_BLOCK)
+  {
+    return 1;
+  }
+  // the indirect block, the double indirect block, and its indirect blocks
+  return 2 + (numBlocks - NUM_DIRECT - PTRS_PER_BLOCK + PTRS_PER_BLOCK - 1) / PTRS_PER_BLOCK;
+}
 
-  // Read the inode bitmap
-  unsigned char inodeBitmap[super.inode_bitmap_len * UFS_BLOCK_SIZE];
-  for (int i = 0; i < super.inode_bitmap_len; i++)
+bool LocalFileSystem::allocatePointerBlocks(inode_t *inode, int blockIndex, Bitmap *dataBits, PointerBlocks *pointers, int *runStart)
+{
+  if (!hasIndirectBlocks || blockIndex < NUM_DIRECT)
   {
-    disk->readBlock(super.inode_bitmap_addr + i, inodeBitmap + i * UFS_BLOCK_SIZE);
+    return true;
   }
 
-  // Check if parent inode is allocated
-  int byteOffset = parentInodeNumber % 8;
-  int bitmapByte = parentInodeNumber / 8;
-  char bitmask = 0b1 << byteOffset;
-  if (!(inodeBitmap[bitmapByte] & bitmask))
+  blockIndex -= NUM_DIRECT;
+  if (blockIndex == 0)
   {
-    return -EINVALIDINODE; // Not allocated
+    int indirectBlock = allocateBlock(dataBits, runStart);
+    if (indirectBlock < 0)
+    {
+      return false;
+    }
+    inode->direct[INDIRECT_PTR] = indirectBlock;
+    pointers->blocks[indirectBlock].assign(PTRS_PER_BLOCK, 0);
+    pointers->dirty.insert(indirectBlock);
+    return true;
   }
 
-  // Read parent inode
-  int inodesPerBlock = UFS_BLOCK_SIZE / sizeof(inode_t);
-  int inodeBlock = super.inode_region_addr + (parentInodeNumber / inodesPerBlock);
-  int inodeOffset = (parentInodeNumber % inodesPerBlock) * sizeof(inode_t);
-  char inodeBlockBuffer[UFS_BLOCK_SIZE];
-  disk->readBlock(inodeBlock, inodeBlockBuffer);
-  inode_t parentInode;
-  memcpy(&parentInode, inodeBlockBuffer + inodeOffset, sizeof(inode_t));
+  blockIndex -= PTRS_PER_BLOCK;
+  if (blockIndex < 0 || blockIndex % PTRS_PER_BLOCK != 0)
+  {
+    return true;
+  }
 
-  if (parentInode.type != UFS_DIRECTORY)
+  if (blockIndex == 0)
   {
-    return -EINVALIDINODE; // Parent is not a directory
+    int doubleBlock = allocateBlock(dataBits, runStart);
+    if (doubleBlock < 0)
+    {
+      return false;
+    }
+    inode->direct[DOUBLE_INDIRECT_PTR] = doubleBlock;
+    pointers->blocks[doubleBlock].assign(PTRS_PER_BLOCK, 0);
+    pointers->dirty.insert(doubleBlock);
   }
 
-  // 5. Check for duplicate `name`
-  int totalEntries = parentInode.size / sizeof(dir_ent_t);
-  dir_ent_t buffer[totalEntries];
-  read(parentInodeNumber, buffer, parentInode.size);
-  for (int i = 0; i < totalEntries; i++)
+  int doubleBlock = inode->direct[DOUBLE_INDIRECT_PTR];
+  int indirectBlock = allocateBlock(dataBits, runStart);
+  if (indirectBlock < 0)
   {
-    if (buffer[i].name == name)
+    if (blockIndex == 0)
     {
-      return -EINVALIDTYPE; // Name exists with the wrong type
+      releaseBlock(doubleBlock, dataBits, pointers);
+      inode->direct[DOUBLE_INDIRECT_PTR] = 0;
     }
+    return false;
+  }
+  pointerBlock(doubleBlock, pointers)[blockIndex / PTRS_PER_BLOCK] = indirectBlock;
+  pointers->dirty.insert(doubleBlock);
+  pointers->blocks[indirectBlock].assign(PTRS_PER_BLOCK, 0);
+  pointers->dirty.insert(indirectBlock);
+  return true;
+}
+
+void LocalFileSystem::freePointerBlocks(inode_t *inode, int numBlocks, int oldBlocks, Bitmap *dataBits, PointerBlocks *pointers)
+{
+  if (pointerBlocksFor(numBlocks) == pointerBlocksFor(oldBlocks))
+  {
+    return;
   }
 
-  // 6. Find a free inode
-  int freeInodeNumber = -1;
-  for (int i = 0; i < super.num_inodes; i++)
+  // The indirect blocks under the double indirect block come first, since
+  // finding them means reading the double indirect block
+  int numChildren = max(0, pointerBlocksFor(numBlocks) - 2);
+  int oldChildren = max(0, pointerBlocksFor(oldBlocks) - 2);
+  if (oldChildren > numChildren)
   {
-    int byteIndex = i / 8;
-    int bitIndex = i % 8;
-    if (!(inodeBitmap[byteIndex] & (1 << bitIndex)))
+    int doubleBlock = inode->direct[DOUBLE_INDIRECT_PTR];
+    unsigned int *children = pointerBlock(doubleBlock, pointers);
+    for (int child = numChildren; child < oldChildren; child++)
     {
-      freeInodeNumber = i;
-      inodeBitmap[byteIndex] |= (1 << bitIndex); // Mark as allocated
-      break;
+      releaseBlock(children[child], dataBits, pointers);
+      children[child] = 0;
     }
+    pointers->dirty.insert(doubleBlock);
   }
-  if (freeInodeNumber == -1)
+  if (oldBlocks > NUM_DIRECT + PTRS_PER_BLOCK && numBlocks <= NUM_DIRECT + PTRS_PER_BLOCK)
   {
-    return -ENOTENOUGHSPACE; // No free inodes
+    releaseBlock(inode->direct[DOUBLE_INDIRECT_PTR], dataBits, pointers);
+    inode->direct[DOUBLE_INDIRECT_PTR] = 0;
   }
+  if (oldBlocks > NUM_DIRECT && numBlocks <= NUM_DIRECT)
+  {
+    releaseBlock(inode->direct[INDIRECT_PTR], dataBits, pointers);
+    inode->direct[INDIRECT_PTR] = 0;
+  }
+}
 
-  // 7. Allocate data block if creating a directory
-  unsigned char dataBitmap[super.data_bitmap_len * UFS_BLOCK_SIZE];
-  for (int i = 0; i < super.data_bitmap_len; i++)
+int LocalFileSystem::resizeBlocks(inode_t *inode, int numBlocks)
+{
+  ScopedMutex dataBitmapGuard(&dataBitmapLock);
+  vector<unsigned char> dataBitmap(dataBitmapBytes);
+  readDataBitmap(&superBlock, dataBitmap.data());
+  Bitmap dataBits(dataBitmap.data(), superBlock.num_data);
+
+  int currentBlocks = blocksInUse(inode);
+  PointerBlocks pointers;
+  int pointerBlockNumber;
+
+  // Free the blocks we no longer need, and then the indirect blocks that
+  // pointed to them
+  for (int i = numBlocks; i < currentBlocks; i++)
   {
-    disk->readBlock(super.data_bitmap_addr + i, dataBitmap + i * UFS_BLOCK_SIZE);
+    unsigned int *slot = blockSlot(inode, i, &pointers, &pointerBlockNumber);
+    releaseBlock(*slot, &dataBits, &pointers);
+    *slot = 0;
+    if (pointerBlockNumber >= 0)
+    {
+      pointers.dirty.insert(pointerBlockNumber);
+    }
   }
+  if (numBlocks < currentBlocks)
+  {
+    freePointerBlocks(inode, numBlocks, currentBlocks, &dataBits, &pointers);
+  }
+
+  // Reuse the blocks we already have and allocate as many more as we can
+  int allocatedBlocks = min(currentBlocks, numBlocks);
 
-  int freeDataBlock = -1;
-  if (type == UFS_DIRECTORY)
+  // Try to put all of the new blocks, and the indirect blocks for them,
+  // in one run, ideally continuing the file's last extent
+  int runStart = -1;
+  if (allocationPolicy == CONTIGUOUS && allocatedBlocks < numBlocks)
   {
-    for (int i = 0; i < super.num_data; i++)
+    int neededBlocks = numBlocks - allocatedBlocks + pointerBlocksFor(numBlocks) - pointerBlocksFor(allocatedBlocks);
+    if (allocatedBlocks > 0)
     {
-      int byteIndex = i / 8;
-      int bitIndex = i % 8;
-      if (!(dataBitmap[byteIndex] & (1 << bitIndex)))
+      int nextBlock = *blockSlot(inode, allocatedBlocks - 1, &pointers, &pointerBlockNumber) - superBlock.data_region_addr + 1;
+      int runEnd = dataBits.findSet(nextBlock);
+      if (runEnd < 0)
+      {
+        runEnd = superBlock.num_data;
+      }
+      if (runEnd - nextBlock >= neededBlocks)
       {
-        freeDataBlock = i;
-        dataBitmap[byteIndex] |= (1 << bitIndex); // Mark as allocated
-        break;
+        runStart = nextBlock;
       }
     }
-    if (freeDataBlock == -1)
+    if (runStart < 0)
     {
-      return -ENOTENOUGHSPACE; // No free blocks
+      runStart = dataBits.findFreeRun(neededBlocks, dataHint);
     }
   }
 
-  // 8. Initialize the new inode
-  inode_t newInode = {};
-  newInode.type = type;
-  newInode.size = (type == UFS_DIRECTORY) ? 2 * sizeof(dir_ent_t) : 0;
-  if (type == UFS_DIRECTORY)
+  while (allocatedBlocks < numBlocks)
   {
-    newInode.direct[0] = super.data_region_addr + freeDataBlock;
-
-    // Create `.` and `..` entries
-    dir_ent_t dirEntries[2];
-    strcpy(dirEntries[0].name, ".");
-    dirEntries[0].inum = freeInodeNumber;
-    strcpy(dirEntries[1].name, "..");
-    dirEntries[1].inum = parentInodeNumber;
-
-    char dirBuffer[UFS_BLOCK_SIZE] = {0};
-    memcpy(dirBuffer, dirEntries, 2 * sizeof(dir_ent_t));
-    disk->writeBlock(newInode.direct[0], dirBuffer);
+    if (!allocatePointerBlocks(inode, allocatedBlocks, &dataBits, &pointers, &runStart))
+    {
+      break;
+    }
+    int newBlock = allocateBlock(&dataBits, &runStart);
+    if (newBlock < 0)
+    {
+      // Give back the indirect blocks that were only for this block
+      freePointerBlocks(inode, allocatedBlocks, allocatedBlocks + 1, &dataBits, &pointers);
+      break;
+    }
+    unsigned int *slot = blockSlot(inode, allocatedBlocks, &pointers, &pointerBlockNumber);
+    *slot = newBlock;
+    if (pointerBlockNumber >= 0)
+    {
+      pointers.dirty.insert(pointerBlockNumber);
+    }
+    allocatedBlocks++;
   }
 
-  // Write the new inode to disk
-  int newInodeBlock = super.inode_region_addr + (freeInodeNumber / inodesPerBlock);
-  int newInodeOffset = (freeInodeNumber % inodesPerBlock) * sizeof(inode_t);
-  char newInodeBlockBuffer[UFS_BLOCK_SIZE];
-  disk->readBlock(newInodeBlock, newInodeBlockBuffer);
-  memcpy(newInodeBlockBuffer + newInodeOffset, &newInode, sizeof(inode_t));
-  disk->writeBlock(newInodeBlock, newInodeBlockBuffer);
+  if (allocatedBlocks != currentBlocks)
+  {
+    writeDataBitmap(&superBlock, dataBitmap.data());
+    writePointerBlocks(&pointers);
+  }
 
-  // 9. Add the new entry to the parent directory
-  dir_ent_t newEntry = {};
-  strcpy(newEntry.name, name.c_str());
-  newEntry.inum = freeInodeNumber;
+  return allocatedBlocks;
+}
 
-  int parentBlock = parentInode.direct[parentInode.size / UFS_BLOCK_SIZE];
-  int offset = (parentInode.size % UFS_BLOCK_SIZE) / sizeof(dir_ent_t);
-  char parentBlockBuffer[UFS_BLOCK_SIZE];
-  disk->readBlock(parentBlock, parentBlockBuffer);
-  memcpy(parentBlockBuffer + offset * sizeof(dir_ent_t), &newEntry, sizeof(dir_ent_t));
-  disk->writeBlock(parentBlock, parentBlockBuffer);
+int LocalFileSystem::writeContents(int inodeNumber, inode_t *inode, const void *buffer, int size)
+{
+  // Small contents go in the inode, and any blocks the file had are freed
+  if (fitsInline(inode, size))
+  {
+    resizeBlocks(inode, 0);
+    memset(inode->direct, 0, sizeof(inode->direct));
+    inode->size = 0;
+    return writeInline(inodeNumber, inode, buffer, size, 0);
+  }
 
-  // Update the parent inode size
-  parentInode.size += sizeof(dir_ent_t);
-  memcpy(inodeBlockBuffer + inodeOffset, &parentInode, sizeof(inode_t));
-  disk->writeBlock(inodeBlock, inodeBlockBuffer);
+  // Inline contents are replaced anyway, so start from an empty file
+  if (fitsInline(inode, inode->size))
+  {
+    memset(inode->direct, 0, sizeof(inode->direct));
+    inode->size = 0;
+  }
 
-  // 10. Write updated bitmaps to disk
-  for (int i = 0; i < super.inode_bitmap_len; i++)
+  int allocatedBlocks = resizeBlocks(inode, blocksForSize(size));
+  if (allocatedBlocks == 0 && fitsInline(inode, 0))
   {
-    disk->writeBlock(super.inode_bitmap_addr + i, inodeBitmap + i * UFS_BLOCK_SIZE);
+    // Without a single free block, keep as much as fits in the inode
+    return writeInline(inodeNumber, inode, buffer, INLINE_DATA_SIZE, 0);
   }
-  for (int i = 0; i < super.data_bitmap_len; i++)
+
+  // When we run out of space we write as much as fits
+  size = min(size, allocatedBlocks * UFS_BLOCK_SIZE);
+
+  // Whole blocks are written straight from the caller's buffer, and the
+  // partial last block is padded with zeros
+  const char *data = static_cast<const char *>(buffer);
+  char blockBuffer[UFS_BLOCK_SIZE] = {0};
+  vector<int> blockNumbers;
+  mapBlocks(inode, 0, blocksForSize(size), &blockNumbers);
+  vector<pair<int, const void *> > blocks;
+  for (int i = 0; i * UFS_BLOCK_SIZE < size; i++)
   {
-    disk->writeBlock(super.data_bitmap_addr + i, dataBitmap + i * UFS_BLOCK_SIZE);
+    int bytesInBlock = min(UFS_BLOCK_SIZE, size - i * UFS_BLOCK_SIZE);
+    if (bytesInBlock < UFS_BLOCK_SIZE)
+    {
+      memcpy(blockBuffer, data + i * UFS_BLOCK_SIZE, bytesInBlock);
+      blocks.push_back(make_pair(blockNumbers[i], (const void *)blockBuffer));
+    }
+    else
+    {
+      blocks.push_back(make_pair(blockNumbers[i], (const void *)(data + i * UFS_BLOCK_SIZE)));
+    }
   }
+  cache->writeBlocks(blocks);
 
-  return freeInodeNumber;
+  inode->size = size;
+  writeInode(inodeNumber, inode);
+
+  return size;
 }
 
-int LocalFileSystem::write(int inodeNumber, const void *buffer, int size)
+int LocalFileSystem::writeInline(int inodeNumber, inode_t *inode, const void *buffer, int size, int offset)
 {
-  // Validate the input size
-  if (size < 0)
+  memcpy(reinterpret_cast<char *>(inode->direct) + offset, buffer, size);
+  inode->size = max(inode->size, offset + size);
+  writeInode(inodeNumber, inode);
+  return size;
+}
+
+int LocalFileSystem::writeRange(int inodeNumber, inode_t *inode, const void *buffer, int size, int offset)
+{
+  if (size == 0)
   {
-    return -EINVALIDSIZE;
+    return 0;
   }
-
-  // Read the superblock
-  super_t super;
-  char superBlockBuffer[UFS_BLOCK_SIZE];
-  disk->readBlock(0, superBlockBuffer);
-  memcpy(&super, superBlockBuffer, sizeof(super_t));
-
-  // Validate the inode number
-  if (inodeNumber < 0 || inodeNumber >= super.num_inodes)
+  if (!fitsInline(inode, inode->size))
   {
-    return -EINVALIDINODE;
+    return writeBlockRange(inodeNumber, inode, buffer, size, offset);
   }
-
-  // Read the inode
-  int inodesPerBlock = UFS_BLOCK_SIZE / sizeof(inode_t);
-  int inodeBlock = super.inode_region_addr + (inodeNumber / inodesPerBlock);
-  int inodeOffset = (inodeNumber % inodesPerBlock) * sizeof(inode_t);
-  char inodeBlockBuffer[UFS_BLOCK_SIZE];
-  disk->readBlock(inodeBlock, inodeBlockBuffer);
-  inode_t inode;
-  memcpy(&inode, inodeBlockBuffer + inodeOffset, sizeof(inode_t));
-
-  // Validate inode type
-  if (inode.type != UFS_REGULAR_FILE)
+  if (fitsInline(inode, offset + size))
   {
-    return -EINVALIDTYPE;
+    return writeInline(inodeNumber, inode, buffer, size, offset);
   }
 
-  // Calculate the required and current blocks
-  int requiredBlocks = (size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
-  int currentBlocks = (inode.size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+  // The file is outgrowing its inode. Write the new data to blocks as if
+  // the file were empty, then put back the old contents in front of it.
+  inode_t inlineInode = *inode;
+  memset(inode->direct, 0, sizeof(inode->direct));
+  inode->size = 0;
+  int bytesWritten = writeBlockRange(inodeNumber, inode, buffer, size, offset);
+  if (inode->size == 0)
+  {
+    // Without a single free block, keep as much as fits in the inode
+    *inode = inlineInode;
+    if (offset >= INLINE_DATA_SIZE)
+    {
+      return -ENOTENOUGHSPACE;
+    }
+    return writeInline(inodeNumber, inode, buffer, INLINE_DATA_SIZE - offset, offset);
+  }
+  int keepSize = min(inlineInode.size, offset);
+  if (keepSize > 0)
+  {
+    writeBlockRange(inodeNumber, inode, inlineInode.direct, keepSize, 0);
+  }
+  return bytesWritten;
+}
 
-  // Allocate additional blocks if needed
-  char dataBitmapBuffer[UFS_BLOCK_SIZE];
-  disk->readBlock(super.data_bitmap_addr, dataBitmapBuffer);
+int LocalFileSystem::writeBlockRange(int inodeNumber, inode_t *inode, const void *buffer, int size, int offset)
+{
+  int oldSize = inode->size;
+  int oldBlocks = blocksForSize(oldSize);
 
-  for (int i = currentBlocks; i < requiredBlocks; i++)
+  // Grow the file if the range goes past the end, as far as space allows.
+  // The file only grows up to the last byte we actually write.
+  int end = offset + size;
+  if (end > oldSize)
   {
-    bool blockAllocated = false;
-    for (int j = 0; j < super.num_data; j++)
+    int allocatedBlocks = resizeBlocks(inode, blocksForSize(end));
+    end = min(end, allocatedBlocks * UFS_BLOCK_SIZE);
+    if (end <= offset)
     {
-      int byteIndex = j / 8;
-      int bitIndex = j % 8;
-
-      if (!(dataBitmapBuffer[byteIndex] & (1 << bitIndex)))
+      // Not even the first byte fits, so give back the blocks for the gap
+      resizeBlocks(inode, oldBlocks);
+      return -ENOTENOUGHSPACE;
+    }
+  }
+  int newSize = max(oldSize, end);
+  int bytesWritten = max(0, end - offset);
+
+  // Whole blocks are written straight from the caller's buffer. Partial
+  // blocks at either end start from their current contents, or from
+  // zeros if they are new, and new blocks in a gap between the old end of
+  // the file and offset are all zeros. The old last block can hold
+  // anything past the old end, e.g., the inum -1 that mkfs puts in unused
+  // root directory slots, so when the file grows that part is cleared.
+  const char *data = static_cast<const char *>(buffer);
+  static const char zeroBlock[UFS_BLOCK_SIZE] = {0};
+  char partialBlocks[3][UFS_BLOCK_SIZE];
+  int numPartial = 0;
+  int firstBlock = min(oldBlocks, offset / UFS_BLOCK_SIZE);
+  int oldTail = oldSize % UFS_BLOCK_SIZE;
+  bool clearsTail = newSize > oldSize && oldTail != 0;
+  if (clearsTail)
+  {
+    firstBlock = min(firstBlock, oldBlocks - 1);
+  }
+  vector<int> blockNumbers;
+  mapBlocks(inode, firstBlock, blocksForSize(newSize) - firstBlock, &blockNumbers);
+  vector<pair<int, const void *> > blocks;
+  for (int blockIndex = firstBlock; blockIndex * UFS_BLOCK_SIZE < newSize; blockIndex++)
+  {
+    int blockNumber = blockNumbers[blockIndex - firstBlock];
+    int blockStart = blockIndex * UFS_BLOCK_SIZE;
+    int copyStart = max(offset, blockStart);
+    int copyEnd = min(end, blockStart + UFS_BLOCK_SIZE);
+    bool isOldTail = clearsTail && blockIndex == oldBlocks - 1;
+    if (copyStart >= copyEnd && !isOldTail)
+    {
+      if (blockIndex >= oldBlocks)
       {
-        // Mark the block as allocated
-        dataBitmapBuffer[byteIndex] |= (1 << bitIndex);
-        inode.direct[i] = super.data_region_addr + j;
-        blockAllocated = true;
-        break;
+        blocks.push_back(make_pair(blockNumber, (const void *)zeroBlock));
       }
+      continue;
+    }
+    if (copyStart == blockStart && copyEnd == blockStart + UFS_BLOCK_SIZE)
+    {
+      blocks.push_back(make_pair(blockNumber, (const void *)(data + blockStart - offset)));
+      continue;
     }
 
-    if (!blockAllocated)
+    char *blockBuffer = partialBlocks[numPartial++];
+    if (blockIndex < oldBlocks && inode->type == UFS_DIRECTORY)
+    {
+      cache->readBlock(blockNumber, blockBuffer);
+    }
+    else if (blockIndex < oldBlocks)
     {
-      return -ENOTENOUGHSPACE; // No free blocks available
+      this->disk->readBlock(blockNumber, blockBuffer);
     }
+    else
+    {
+      memset(blockBuffer, 0, UFS_BLOCK_SIZE);
+    }
+    if (isOldTail)
+    {
+      memset(blockBuffer + oldTail, 0, UFS_BLOCK_SIZE - oldTail);
+    }
+    if (copyStart < copyEnd)
+    {
+      memcpy(blockBuffer + (copyStart - blockStart), data + copyStart - offset, copyEnd - copyStart);
+    }
+    blocks.push_back(make_pair(blockNumber, (const void *)blockBuffer));
   }
+  cache->writeBlocks(blocks);
 
-  // Write back the updated data bitmap
-  disk->writeBlock(super.data_bitmap_addr, dataBitmapBuffer);
-
-  // Write data to blocks
-  int bytesWritten = 0;
-  for (int i = 0; i < requiredBlocks; i++)
+  if (newSize != oldSize)
   {
-    int blockNum = inode.direct[i];
-    int offset = bytesWritten;
-    int chunkSize = std::min(UFS_BLOCK_SIZE, size - bytesWritten);
-
-    char blockBuffer[UFS_BLOCK_SIZE] = {0};
-    memcpy(blockBuffer, static_cast<const char *>(buffer) + offset, chunkSize);
-    disk->writeBlock(blockNum, blockBuffer);
-
-    bytesWritten += chunkSize;
+    inode->size = newSize;
+    writeInode(inodeNumber, inode);
   }
 
-  // Update inode size and write it back
-  inode.size = size;
-  memcpy(inodeBlockBuffer + inodeOffset, &inode, sizeof(inode_t));
-  disk->writeBlock(inodeBlock, inodeBlockBuffer);
-
   return bytesWritten;
 }
 
-int LocalFileSystem::unlink(int parentInodeNumber, string name)
+int LocalFileSystem::create(int parentInodeNumber, int type, string name)
 {
+  ScopedTransaction transaction(disk);
+  checkRollbacks();
+
   // 1. Validate `name`
   if (name.empty() || name.length() >= DIR_ENT_NAME_SIZE)
   {
-    return -EINVALIDNAME; // Invalid name
+    return -EINVALIDNAME; // Invalid name length
   }
-  if (name == "." || name == "..")
+
+  // 2. Validate `type`
+  if (type != UFS_REGULAR_FILE && type != UFS_DIRECTORY)
   {
-    return -EUNLINKNOTALLOWED; // Cannot unlink "." or ".."
+    return -EINVALIDTYPE; // Invalid type
   }
 
-  // 2. Read the superblock
-  super_t super;
-  char superBlockBuffer[UFS_BLOCK_SIZE];
-  disk->readBlock(0, superBlockBuffer);
-  memcpy(&super, superBlockBuffer, sizeof(super_t));
-
   // 3. Validate `parentInodeNumber`
-  if (parentInodeNumber < 0 || parentInodeNumber >= super.num_inodes)
+  ScopedRwLock parentLock(inodeLock(parentInodeNumber), true);
+  inode_t parentInode;
+  if (this->stat(parentInodeNumber, &parentInode) != 0 || parentInode.type != UFS_DIRECTORY)
   {
-    return -EINVALIDINODE; // Out of bounds
+    return -EINVALIDINODE;
   }
 
-  // Read the inode bitmap
-  unsigned char inodeBitmap[super.inode_bitmap_len * UFS_BLOCK_SIZE];
-  for (int i = 0; i < super.inode_bitmap_len; i++)
+  // 4. Creating something that already exists is fine if the type matches
+  int existingInodeNumber = lookupEntry(parentInodeNumber, name);
+  if (existingInodeNumber >= 0)
   {
-    disk->readBlock(super.inode_bitmap_addr + i, inodeBitmap + i * UFS_BLOCK_SIZE);
+    inode_t existingInode;
+    if (this->stat(existingInodeNumber, &existingInode) != 0 || existingInode.type != type)
+    {
+      return -EINVALIDTYPE; // Name exists with the wrong type
+    }
+    return existingInodeNumber;
   }
 
-  // Check if parent inode is allocated
-  int byteOffset = parentInodeNumber % 8;
-  int bitmapByte = parentInodeNumber / 8;
-  char bitmask = 0b1 << byteOffset;
-  if (!(inodeBitmap[bitmapByte] & bitmask))
+  // 5. Find everything we need before changing anything on disk
+  int parentSize = parentInode.size + sizeof(dir_ent_t);
+  if (parentSize > maxFileSize())
   {
-    return -EINVALIDINODE; // Not allocated
+    return -ENOTENOUGHSPACE; // The parent directory is full
   }
 
-  // Read parent inode
-  int inodesPerBlock = UFS_BLOCK_SIZE / sizeof(inode_t);
-  int parentInodeBlock = super.inode_region_addr + (parentInodeNumber / inodesPerBlock);
-  int parentInodeOffset = (parentInodeNumber % inodesPerBlock) * sizeof(inode_t);
-  char parentInodeBlockBuffer[UFS_BLOCK_SIZE];
-  disk->readBlock(parentInodeBlock, parentInodeBlockBuffer);
-  inode_t parentInode;
-  memcpy(&parentInode, parentInodeBlockBuffer + parentInodeOffset, sizeof(inode_t));
-
-  if (parentInode.type != UFS_DIRECTORY)
+  int newInodeNumber;
+  int newDataBlock = -1;
   {
-    return -EINVALIDINODE; // Parent is not a directory
-  }
+    ScopedMutex inodeBitmapGuard(&inodeBitmapLock);
+    ScopedMutex dataBitmapGuard(&dataBitmapLock);
+    vector<unsigned char> inodeBitmap(inodeBitmapBytes);
+    readInodeBitmap(&superBlock, inodeBitmap.data());
+    Bitmap inodeBits(inodeBitmap.data(), superBlock.num_inodes);
+    newInodeNumber = inodeBits.findFree(inodeHint);
+    if (newInodeNumber < 0)
+    {
+      inodeHint = superBlock.num_inodes;
+      return -ENOTENOUGHSPACE; // No free inodes
+    }
+    inodeHint = newInodeNumber;
+
+    vector<unsigned char> dataBitmap(dataBitmapBytes);
+    readDataBitmap(&superBlock, dataBitmap.data());
+    Bitmap dataBits(dataBitmap.data(), superBlock.num_data);
+    if (type == UFS_DIRECTORY)
+    {
+      newDataBlock = dataBits.findFree(dataHint);
+      if (newDataBlock < 0)
+      {
+        dataHint = superBlock.num_data;
+        return -ENOTENOUGHSPACE; // No free blocks
+      }
+      dataHint = newDataBlock;
+      dataBits.set(newDataBlock);
+    }
+    if (parentInode.size % UFS_BLOCK_SIZE == 0 && dataBits.findFree(dataHint) < 0)
+    {
+      return -ENOTENOUGHSPACE; // No room to grow the parent directory
+    }
 
-  // 4. Locate the target entry in the parent directory
-  int totalEntries = parentInode.size / sizeof(dir_ent_t);
-  dir_ent_t dirEntries[totalEntries];
-  read(parentInodeNumber, dirEntries, parentInode.size);
+    // 6. Initialize the new inode
+    inodeBits.set(newInodeNumber);
+    inodeHint = newInodeNumber + 1;
+    writeInodeBitmap(&superBlock, inodeBitmap.data());
+
+    inode_t newInode = {};
+    newInode.type = type;
+    if (type == UFS_DIRECTORY)
+    {
+      writeDataBitmap(&superBlock, dataBitmap.data());
+      dataHint = newDataBlock + 1;
+
+      newInode.size = 2 * sizeof(dir_ent_t);
+      newInode.direct[0] = superBlock.data_region_addr + newDataBlock;
+
+      // Create `.` and `..` entries
+      char dirBuffer[UFS_BLOCK_SIZE] = {0};
+      dir_ent_t *dirEntries = reinterpret_cast<dir_ent_t *>(dirBuffer);
+      strcpy(dirEntries[0].name, ".");
+      dirEntries[0].inum = newInodeNumber;
+      strcpy(dirEntries[1].name, "..");
+      dirEntries[1].inum = parentInodeNumber;
+      cache->writeBlock(newInode.direct[0], dirBuffer);
+      // the inode number may have belonged to a directory before
+      touchDirectory(newInodeNumber, shared_ptr<DirectoryIndex>());
+    }
+    writeInode(newInodeNumber, &newInode);
+  }
 
-  int targetIndex = -1;
-  for (int i = 0; i < totalEntries; i++)
+  // 7. Append the new entry to the parent directory. If the parent can't
+  // grow after all, e.g., because it also needs an indirect block, give
+  // back what we allocated.
+  dir_ent_t newEntry = {};
+  strcpy(newEntry.name, name.c_str());
+  newEntry.inum = newInodeNumber;
+  int newSlot = parentInode.size / sizeof(dir_ent_t);
+  if (writeRange(parentInodeNumber, &parentInode, &newEntry, sizeof(dir_ent_t), parentInode.size) != (int)sizeof(dir_ent_t))
   {
-    if (name == dirEntries[i].name)
+    ScopedMutex inodeBitmapGuard(&inodeBitmapLock);
+    ScopedMutex dataBitmapGuard(&dataBitmapLock);
+    vector<unsigned char> inodeBitmap(inodeBitmapBytes);
+    readInodeBitmap(&superBlock, inodeBitmap.data());
+    Bitmap(inodeBitmap.data(), superBlock.num_inodes).clear(newInodeNumber);
+    inodeHint = min(inodeHint, newInodeNumber);
+    writeInodeBitmap(&superBlock, inodeBitmap.data());
+    if (newDataBlock >= 0)
     {
-      targetIndex = i;
-      break;
+      vector<unsigned char> dataBitmap(dataBitmapBytes);
+      readDataBitmap(&superBlock, dataBitmap.data());
+      Bitmap(dataBitmap.data(), superBlock.num_data).clear(newDataBlock);
+      dataHint = min(dataHint, newDataBlock);
+      writeDataBitmap(&superBlock, dataBitmap.data());
     }
+    return -ENOTENOUGHSPACE;
   }
 
-  if (targetIndex == -1)
+  shared_ptr<DirectoryIndex> index = directoryIndex(parentInodeNumber, &parentInode);
+  touchDirectory(parentInodeNumber, index);
+  if ((int)index->entries.size() == newSlot)
   {
-    return -ENOTFOUND; // Entry not found
+    index->entries.push_back(newEntry);
+    index->slots.emplace(name, newSlot);
   }
+  invalidateDentry(parentInodeNumber, name);
 
-  // Get the inode number of the target
-  int targetInodeNumber = dirEntries[targetIndex].inum;
+  return newInodeNumber;
+}
 
-  // Read the target inode
-  int targetInodeBlock = super.inode_region_addr + (targetInodeNumber / inodesPerBlock);
-  int targetInodeOffset = (targetInodeNumber % inodesPerBlock) * sizeof(inode_t);
-  char targetInodeBlockBuffer[UFS_BLOCK_SIZE];
-  disk->readBlock(targetInodeBlock, targetInodeBlockBuffer);
-  inode_t targetInode;
-  memcpy(&targetInode, targetInodeBlockBuffer + targetInodeOffset, sizeof(inode_t));
+int LocalFileSystem::write(int inodeNumber, const void *buffer, int size)
+{
+  ScopedTransaction transaction(disk);
+  checkRollbacks();
+  ScopedRwLock lock(inodeLock(inodeNumber), true);
 
-  // 5. Handle unlinking based on type
-  if (targetInode.type == UFS_DIRECTORY)
+  // Validate the input size
+  if (size < 0 || size > maxFileSize())
   {
-    // Ensure directory is empty (only `.` and `..` should exist)
-    if (targetInode.size > static_cast<int>(2 * sizeof(dir_ent_t)))
-    {
-      return -EDIRNOTEMPTY; // Cannot unlink a non-empty directory
-    }
+    return -EINVALIDSIZE;
   }
 
-  // Deallocate data blocks (if any)
-  unsigned char dataBitmap[super.data_bitmap_len * UFS_BLOCK_SIZE];
-  for (int i = 0; i < super.data_bitmap_len; i++)
+  inode_t inode;
+  if (this->stat(inodeNumber, &inode) != 0)
   {
-    disk->readBlock(super.data_bitmap_addr + i, dataBitmap + i * UFS_BLOCK_SIZE);
+    return -EINVALIDINODE;
   }
 
-  int numBlocks = (targetInode.size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
-  for (int i = 0; i < numBlocks; i++)
+  // Validate inode type
+  if (inode.type != UFS_REGULAR_FILE)
   {
-    int blockNumber = targetInode.direct[i] - super.data_region_addr;
-    int byteIndex = blockNumber / 8;
-    int bitIndex = blockNumber % 8;
-    dataBitmap[byteIndex] &= ~(1 << bitIndex); // Mark block as free
+    return -EINVALIDTYPE;
   }
 
-  // Write updated data bitmap
-  for (int i = 0; i < super.data_bitmap_len; i++)
+  return writeContents(inodeNumber, &inode, buffer, size);
+}
+
+int LocalFileSystem::pwrite(int inodeNumber, const void *buffer, int size, int offset)
+{
+  ScopedTransaction transaction(disk);
+  checkRollbacks();
+  ScopedRwLock lock(inodeLock(inodeNumber), true);
+
+  // Validate the input size and offset
+  if (size < 0 || offset < 0 || offset > maxFileSize() - size)
   {
-    disk->writeBlock(super.data_bitmap_addr + i, dataBitmap + i * UFS_BLOCK_SIZE);
+    return -EINVALIDSIZE;
   }
 
-  // Deallocate the target inode
-  int targetByteIndex = targetInodeNumber / 8;
-  int targetBitIndex = targetInodeNumber % 8;
-  inodeBitmap[targetByteIndex] &= ~(1 << targetBitIndex); // Mark inode as free
+  inode_t inode;
+  if (this->stat(inodeNumber, &inode) != 0)
+  {
+    return -EINVALIDINODE;
+  }
 
-  // Write updated inode bitmap
-  for (int i = 0; i < super.inode_bitmap_len; i++)
+  // Validate inode type
+  if (inode.type != UFS_REGULAR_FILE)
   {
-    disk->writeBlock(super.inode_bitmap_addr + i, inodeBitmap + i * UFS_BLOCK_SIZE);
+    return -EINVALIDTYPE;
   }
 
-  // 6. Remove the directory entry from the parent
-  if (targetIndex < totalEntries - 1)
+  return writeRange(inodeNumber, &inode, buffer, size, offset);
+}
+
+int LocalFileSystem::unlink(int parentInodeNumber, string name)
+{
+  ScopedTransaction transaction(disk);
+  checkRollbacks();
+
+  // 1. Validate `name`
+  if (name.empty() || name.length() >= DIR_ENT_NAME_SIZE)
   {
-    dirEntries[targetIndex] = dirEntries[totalEntries - 1]; // Replace with last entry
+    return -EINVALIDNAME; // Invalid name
+  }
+  if (name == "." || name == "..")
+  {
+    return -EUNLINKNOTALLOWED; // Cannot unlink "." or ".."
   }
-  parentInode.size -= sizeof(dir_ent_t);
 
-  // Write back the updated parent directory
-  write(parentInodeNumber, dirEntries, parentInode.size);
+  // 2. Validate `parentInodeNumber`
+  ScopedRwLock parentLock(inodeLock(parentInodeNumber), true);
+  inode_t parentInode;
+  if (this->stat(parentInodeNumber, &parentInode) != 0 || parentInode.type != UFS_DIRECTORY)
+  {
+    return -EINVALIDINODE;
+  }
 
-  // Update parent inode
-  memcpy(parentInodeBlockBuffer + parentInodeOffset, &parentInode, sizeof(inode_t));
-  disk->writeBlock(parentInodeBlock, parentInodeBlockBuffer);
+  // 3. Locate the target entry in the parent directory
+  shared_ptr<DirectoryIndex> index = directoryIndex(parentInodeNumber, &parentInode);
+  unordered_map<string, int>::iterator slot = index->slots.find(name);
+  if (slot == index->slots.end())
+  {
+    return 0; // Unlinking a name that doesn't exist is not an error
+  }
+
+  int targetIndex = slot->second;
+  int targetInodeNumber = index->entries[targetIndex].inum;
+  if (targetInodeNumber == parentInodeNumber)
+  {
+    return -EINVALIDINODE; // Only a corrupt directory contains itself under another name
+  }
+  ScopedRwLock targetLock(inodeLock(targetInodeNumber), true);
+  inode_t targetInode;
+  if (this->stat(targetInodeNumber, &targetInode) != 0)
+  {
+    return -EINVALIDINODE;
+  }
+
+  // 4. Directories must be empty (only `.` and `..` should exist)
+  if (targetInode.type == UFS_DIRECTORY && targetInode.size > static_cast<int>(2 * sizeof(dir_ent_t)))
+  {
+    return -EDIRNOTEMPTY;
+  }
+
+  // 5. Free the target's data blocks, including any indirect blocks, and inode
+  resizeBlocks(&targetInode, 0);
+
+  {
+    ScopedMutex inodeBitmapGuard(&inodeBitmapLock);
+    vector<unsigned char> inodeBitmap(inodeBitmapBytes);
+    readInodeBitmap(&superBlock, inodeBitmap.data());
+    Bitmap(inodeBitmap.data(), superBlock.num_inodes).clear(targetInodeNumber);
+    inodeHint = min(inodeHint, targetInodeNumber);
+    writeInodeBitmap(&superBlock, inodeBitmap.data());
+  }
+
+  // 6. Remove the entry from the parent, moving the last entry into its
+  // place so the directory stays packed, then clear the old last slot so
+  // nothing is left past the end of the directory
+  int lastOffset = parentInode.size - sizeof(dir_ent_t);
+  dir_ent_t lastEntry = index->entries.back();
+  if (targetIndex * (int)sizeof(dir_ent_t) != lastOffset)
+  {
+    writeRange(parentInodeNumber, &parentInode, &lastEntry, sizeof(dir_ent_t), targetIndex * sizeof(dir_ent_t));
+  }
+  if (lastOffset % UFS_BLOCK_SIZE != 0)
+  {
+    dir_ent_t emptyEntry = {};
+    writeRange(parentInodeNumber, &parentInode, &emptyEntry, sizeof(dir_ent_t), lastOffset);
+  }
+  resizeBlocks(&parentInode, blocksForSize(lastOffset));
+  parentInode.size = lastOffset;
+  writeInode(parentInodeNumber, &parentInode);
+
+  // 7. Apply the same move to the index
+  touchDirectory(parentInodeNumber, index);
+  index->slots.erase(slot);
+  if (targetIndex != (int)index->entries.size() - 1)
+  {
+    index->entries[targetIndex] = lastEntry;
+    unordered_map<string, int>::iterator moved = index->slots.find(string(lastEntry.name, strnlen(lastEntry.name, DIR_ENT_NAME_SIZE)));
+    if (moved != index->slots.end() && moved->second == (int)index->entries.size() - 1)
+    {
+      moved->second = targetIndex;
+    }
+  }
+  index->entries.pop_back();
+  if (targetInode.type == UFS_DIRECTORY)
+  {
+    touchDirectory(targetInodeNumber, shared_ptr<DirectoryIndex>());
+  }
+
+  // The name is gone, and so is everything cached under a removed
+  // directory, since its inode number can be reused
+  invalidateDentry(parentInodeNumber, name);
+  ScopedMutex dentryGuard(&dentryLock);
+  unordered_map<int, unordered_map<string, Dentry> >::iterator removed = dentries.find(targetInodeNumber);
+  if (removed != dentries.end())
+  {
+    dentryCount -= removed->second.size();
+    dentries.erase(removed);
+  }
 
   return 0; // Success
-}
\ No newline at end of file
+}
@@ -30,8 +30,9 @@ MyServerSocket::MyServerSocket(int port)
         throw SocketError(str);
     }	
     
-    //set up a listen queue
-    listen(serverFd, 10);
+    //set up a listen queue, as long as the system allows since the
+    //epoll loop in gunrock takes connections in bursts
+    listen(serverFd, SOMAXCONN);
 }
 
 MySocket *MyServerSocket::accept()
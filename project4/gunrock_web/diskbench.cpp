@@ -0,0 +1,120 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+#include "Disk.h"
+#include "ufs.h"
+
+using namespace std;
+
+// Reads every block of the image `passes` times and returns blocks/sec
+double benchmarkReads(Disk *disk, int passes)
+{
+  vector<unsigned char> buffer(UFS_BLOCK_SIZE);
+  int numBlocks = disk->numberOfBlocks();
+
+  auto start = chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; pass++)
+  {
+    for (int blockNumber = 0; blockNumber < numBlocks; blockNumber++)
+    {
+      disk->readBlock(blockNumber, buffer.data());
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  return (double)numBlocks * passes / elapsed.count();
+}
+
+// Same as benchmarkReads, but reads each 30 block run (the largest
+// file) with one readBlocks call
+double benchmarkVectoredReads(Disk *disk, int passes)
+{
+  int numBlocks = disk->numberOfBlocks();
+  vector<unsigned char> buffer((size_t)DIRECT_PTRS * UFS_BLOCK_SIZE);
+
+  auto start = chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; pass++)
+  {
+    for (int blockNumber = 0; blockNumber < numBlocks; blockNumber += DIRECT_PTRS)
+    {
+      vector<pair<int, void *> > blocks;
+      for (int idx = 0; idx < DIRECT_PTRS && blockNumber + idx < numBlocks; idx++)
+      {
+        blocks.push_back(make_pair(blockNumber + idx, (void *)(buffer.data() + (size_t)idx * UFS_BLOCK_SIZE)));
+      }
+      disk->readBlocks(blocks);
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  return (double)numBlocks * passes / elapsed.count();
+}
+
+// Rewrites every block of the image with its current contents, so the
+// image is left unchanged, and returns blocks/sec. With `transactional`
+// each pass is a single transaction, so it only syncs once at commit.
+double benchmarkWrites(Disk *disk, int passes, bool transactional)
+{
+  int numBlocks = disk->numberOfBlocks();
+  vector<unsigned char> image((size_t)numBlocks * UFS_BLOCK_SIZE);
+  for (int blockNumber = 0; blockNumber < numBlocks; blockNumber++)
+  {
+    disk->readBlock(blockNumber, image.data() + (size_t)blockNumber * UFS_BLOCK_SIZE);
+  }
+
+  auto start = chrono::steady_clock::now();
+  for (int pass = 0; pass < passes; pass++)
+  {
+    if (transactional)
+    {
+      disk->beginTransaction();
+    }
+    for (int blockNumber = 0; blockNumber < numBlocks; blockNumber++)
+    {
+      disk->writeBlock(blockNumber, image.data() + (size_t)blockNumber * UFS_BLOCK_SIZE);
+    }
+    if (transactional)
+    {
+      disk->commit();
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  return (double)numBlocks * passes / elapsed.count();
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2 || argc > 4)
+  {
+    cerr << argv[0] << ": diskImageFile [readPasses] [writePasses]" << endl;
+    cerr << "For example:" << endl;
+    cerr << "    $ " << argv[0] << " tests/disk_images/a.img 100 1" << endl;
+    return 1;
+  }
+
+  string imageFile = string(argv[1]);
+  int readPasses = argc > 2 ? stoi(argv[2]) : 100;
+  int writePasses = argc > 3 ? stoi(argv[3]) : 1;
+
+  Disk::Backend backends[] = {Disk::OPEN_PER_CALL, Disk::PERSISTENT, Disk::MMAP};
+  string names[] = {"open per call", "persistent", "mmap"};
+
+  cout << "Blocks/sec" << endl;
+  for (int idx = 0; idx < 3; idx++)
+  {
+    unique_ptr<Disk> disk = make_unique<Disk>(imageFile, UFS_BLOCK_SIZE, backends[idx]);
+    cout << names[idx] << " read " << (long)benchmarkReads(disk.get(), readPasses) << endl;
+    cout << names[idx] << " vectored read " << (long)benchmarkVectoredReads(disk.get(), readPasses) << endl;
+    if (writePasses > 0)
+    {
+      cout << names[idx] << " write " << (long)benchmarkWrites(disk.get(), writePasses, false) << endl;
+      cout << names[idx] << " transactional write " << (long)benchmarkWrites(disk.get(), writePasses, true) << endl;
+    }
+  }
+
+  return 0;
+}
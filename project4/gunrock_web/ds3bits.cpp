@@ -3,8 +3,10 @@
 #include <algorithm>
 #include <cstring>
 #include <memory>
+#include <vector>
 
 #include "LocalFileSystem.h"
+#include "Bitmap.h"
 #include "Disk.h"
 #include "ufs.h"
 
@@ -12,9 +14,9 @@ using namespace std;
 
 int main(int argc, char *argv[])
 {
-  if (argc != 2)
+  if (argc != 2 && !(argc == 3 && string(argv[2]) == "--stats"))
   {
-    cerr << argv[0] << ": diskImageFile" << endl;
+    cerr << argv[0] << ": diskImageFile [--stats]" << endl;
     return 1;
   }
 
@@ -24,16 +26,31 @@ int main(int argc, char *argv[])
   LocalFileSystem *fileSystem = new LocalFileSystem(disk);
   */
 
-  unique_ptr<Disk> disk = make_unique<Disk>(argv[1], UFS_BLOCK_SIZE);
+  unique_ptr<Disk> disk = make_unique<Disk>(argv[1], UFS_BLOCK_SIZE, Disk::MMAP);
   unique_ptr<LocalFileSystem> fileSystem = make_unique<LocalFileSystem>(disk.get());
 
   // Get metadata
   super_t super;
   fileSystem->readSuperBlock(&super);
-  unsigned char inode_bitmap[super.inode_region_len * UFS_BLOCK_SIZE];
-  fileSystem->readInodeBitmap(&super, inode_bitmap);
-  unsigned char data_bitmap[super.data_region_len * UFS_BLOCK_SIZE];
-  fileSystem->readDataBitmap(&super, data_bitmap);
+
+  // The bitmaps are contiguous on disk, so with a memory mapped image we
+  // can print them straight out of the mapping without copying
+  vector<unsigned char> inode_bitmap_buffer;
+  const unsigned char *inode_bitmap = static_cast<const unsigned char *>(disk->blockPtr(super.inode_bitmap_addr));
+  if (inode_bitmap == NULL)
+  {
+    inode_bitmap_buffer.resize(super.inode_bitmap_len * UFS_BLOCK_SIZE);
+    fileSystem->readInodeBitmap(&super, inode_bitmap_buffer.data());
+    inode_bitmap = inode_bitmap_buffer.data();
+  }
+  vector<unsigned char> data_bitmap_buffer;
+  const unsigned char *data_bitmap = static_cast<const unsigned char *>(disk->blockPtr(super.data_bitmap_addr));
+  if (data_bitmap == NULL)
+  {
+    data_bitmap_buffer.resize(super.data_bitmap_len * UFS_BLOCK_SIZE);
+    fileSystem->readDataBitmap(&super, data_bitmap_buffer.data());
+    data_bitmap = data_bitmap_buffer.data();
+  }
 
   // Print filesystem metadata
   cout << "Super" << endl;
@@ -63,5 +80,66 @@ int main(int argc, char *argv[])
     cout << static_cast<unsigned int>(data_bitmap[idx]) << ' ';
   cout << endl;
 
+  // Allocation summary, not part of the default output
+  if (argc == 3)
+  {
+    vector<unsigned char> inode_bits(inode_bitmap, inode_bitmap + super.inode_bitmap_len * UFS_BLOCK_SIZE);
+    vector<unsigned char> data_bits(data_bitmap, data_bitmap + super.data_bitmap_len * UFS_BLOCK_SIZE);
+    Bitmap inodes(inode_bits.data(), super.num_inodes);
+    Bitmap data(data_bits.data(), super.num_data);
+
+    cout << endl
+         << "Stats" << endl;
+    cout << "inodes_used " << inodes.countSet() << endl;
+    cout << "inodes_free " << super.num_inodes - inodes.countSet() << endl;
+    cout << "first_free_inode " << inodes.findFree() << endl;
+    cout << "data_used " << data.countSet() << endl;
+    cout << "data_free " << super.num_data - data.countSet() << endl;
+    cout << "first_free_data " << data.findFree() << endl;
+
+    // Free space fragmentation: how many runs the free blocks are split into
+    int free_extents = 0;
+    int largest_free_extent = 0;
+    for (int start = data.findFree(); start >= 0;)
+    {
+      int end = data.findSet(start);
+      if (end < 0)
+        end = super.num_data;
+      free_extents++;
+      largest_free_extent = max(largest_free_extent, end - start);
+      start = data.findFree(end);
+    }
+    cout << "free_extents " << free_extents << endl;
+    cout << "largest_free_extent " << largest_free_extent << endl;
+
+    // File fragmentation: an extent is a run of consecutive data blocks
+    int files = 0;
+    int file_extents = 0;
+    int fragmented_files = 0;
+    int inline_files = 0;
+    for (int inum = 0; inum < super.num_inodes; inum++)
+    {
+      if (inodes.isSet(inum) && fileSystem->isInline(inum))
+        inline_files++;
+      vector<int> blocks;
+      if (!inodes.isSet(inum) || fileSystem->blockNumbers(inum, &blocks) || blocks.empty())
+        continue;
+      int extents = 1;
+      for (size_t idx = 1; idx < blocks.size(); idx++)
+      {
+        if (blocks[idx] != blocks[idx - 1] + 1)
+          extents++;
+      }
+      files++;
+      file_extents += extents;
+      if (extents > 1)
+        fragmented_files++;
+    }
+    cout << "file_extents " << file_extents << endl;
+    cout << "fragmented_files " << fragmented_files << endl;
+    cout << "extents_per_file " << (files > 0 ? (double)file_extents / files : 0.0) << endl;
+    cout << "inline_files " << inline_files << endl;
+  }
+
   return 0;
 }
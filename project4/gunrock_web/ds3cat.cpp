@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <memory>
 #include <cstring>
+#include <vector>
 
 #include "LocalFileSystem.h"
 #include "Disk.h"
@@ -19,7 +20,7 @@ int main(int argc, char *argv[])
   }
 
   // Parse command line arguments
-  unique_ptr<Disk> disk = make_unique<Disk>(argv[1], UFS_BLOCK_SIZE);
+  unique_ptr<Disk> disk = make_unique<Disk>(argv[1], UFS_BLOCK_SIZE, Disk::MMAP);
   unique_ptr<LocalFileSystem> fileSystem = make_unique<LocalFileSystem>(disk.get());
   int inodeNumber = stoi(argv[2]);
 
@@ -31,27 +32,43 @@ int main(int argc, char *argv[])
     return 1;
   }
 
-  int num_blocks = inode.size / UFS_BLOCK_SIZE;
-  if (inode.size % UFS_BLOCK_SIZE)
+  vector<int> blocks;
+  if (fileSystem->blockNumbers(inodeNumber, &blocks))
   {
-    num_blocks += 1;
+    cerr << "Error reading file" << endl;
+    return 1;
   }
+  int num_blocks = blocks.size();
 
-  // Print disk block numbers
+  // Print disk block numbers, small files have their data in the inode
   cout << "File blocks" << endl;
+  if (fileSystem->isInline(inodeNumber))
+    cout << "inline" << endl;
   for (int idx = 0; idx < num_blocks; idx++)
-    cout << inode.direct[idx] << endl;
+    cout << blocks[idx] << endl;
   cout << endl;
 
-  // Print file contents
+  // Print file contents, straight from the memory mapped image if we can
   cout << "File data" << endl;
-  char file_contents[inode.size];
-  if (fileSystem->read(inodeNumber, file_contents, inode.size) != inode.size)
+  if (num_blocks > 0 && disk->blockPtr(blocks[0]) != NULL)
+  {
+    int bytes_left = inode.size;
+    for (int idx = 0; idx < num_blocks; idx++)
+    {
+      int bytes_in_block = min(bytes_left, UFS_BLOCK_SIZE);
+      cout.write(static_cast<const char *>(disk->blockPtr(blocks[idx])), bytes_in_block);
+      bytes_left -= bytes_in_block;
+    }
+    return 0;
+  }
+
+  vector<char> file_contents(inode.size);
+  if (fileSystem->read(inodeNumber, file_contents.data(), inode.size) != inode.size)
   {
     cerr << "Error reading file" << endl;
     return 1;
   }
-  cout.write(file_contents, inode.size);
+  cout.write(file_contents.data(), inode.size);
 
   return 0;
 }
@@ -16,9 +16,29 @@ using namespace std;
 
 int main(int argc, char *argv[])
 {
-  if (argc != 4)
+  // --offset writes the source into the file at that offset with pwrite,
+  // leaving the rest of the file as it is, instead of replacing it
+  bool isContiguous = false;
+  int offset = -1;
+  bool isUsage = argc < 4;
+  for (int arg = 4; arg < argc && !isUsage; arg++)
   {
-    cerr << argv[0] << ": diskImageFile src_file dst_inode" << endl;
+    if (string(argv[arg]) == "--contiguous")
+    {
+      isContiguous = true;
+    }
+    else if (string(argv[arg]) == "--offset" && arg + 1 < argc)
+    {
+      offset = atoi(argv[++arg]);
+    }
+    else
+    {
+      isUsage = true;
+    }
+  }
+  if (isUsage)
+  {
+    cerr << argv[0] << ": diskImageFile src_file dst_inode [--contiguous] [--offset bytes]" << endl;
     cerr << "For example:" << endl;
     cerr << "    $ " << argv[0] << " tests/disk_images/a.img dthread.cpp 3" << endl;
     return 1;
@@ -36,6 +56,10 @@ int main(int argc, char *argv[])
   unique_ptr<LocalFileSystem> fileSystem = make_unique<LocalFileSystem>(disk.get());
   string srcFile = string(argv[2]);
   int dstInode = stoi(argv[3]);
+  if (isContiguous)
+  {
+    fileSystem->setAllocationPolicy(LocalFileSystem::CONTIGUOUS);
+  }
 
   // Open the source file
   int srcFd = open(srcFile.c_str(), O_RDONLY);
@@ -62,7 +86,16 @@ int main(int argc, char *argv[])
 
   // Write the file to the disk
   disk->beginTransaction();
-  if (fileSystem->write(dstInode, write_buffer.c_str(), write_buffer.size()) < 0)
+  int ret;
+  if (offset >= 0)
+  {
+    ret = fileSystem->pwrite(dstInode, write_buffer.c_str(), write_buffer.size(), offset);
+  }
+  else
+  {
+    ret = fileSystem->write(dstInode, write_buffer.c_str(), write_buffer.size());
+  }
+  if (ret < 0)
   {
     disk->rollback();
     cerr << "Could not write to dst_file" << endl;
@@ -20,46 +20,14 @@ bool compareByName(const dir_ent_t &a, const dir_ent_t &b)
 
 int listDirectory(LocalFileSystem *fileSystem, const string &directory)
 {
-  if (directory.empty() || directory[0] != '/')
+  // Find inode of directory
+  int inode_num = fileSystem->resolvePath(directory);
+  if (inode_num < 0)
   {
     cerr << "Directory not found" << endl;
     return 1;
   }
 
-  // Find inode of directory
-  int inode_num = UFS_ROOT_DIRECTORY_INODE_NUMBER;
-  int parent_inode_num = inode_num;
-  if (directory.size() != 1)
-  {
-    string segment;
-    for (auto iter = directory.begin() + 1; iter != directory.end(); ++iter)
-    {
-      if (*iter == '/')
-      {
-        parent_inode_num = inode_num;
-        inode_num = fileSystem->lookup(inode_num, segment);
-        if (inode_num < 0)
-        {
-          cerr << "Directory not found" << endl;
-          return 1;
-        }
-        segment.clear();
-      }
-      else
-      {
-        segment += *iter;
-      }
-    }
-    // One more time for last path segment
-    parent_inode_num = inode_num;
-    inode_num = fileSystem->lookup(inode_num, segment);
-    if (inode_num < 0)
-    {
-      cerr << "Directory not found" << endl;
-      return 1;
-    }
-  }
-
   // Create inode struct
   inode_t inode;
   if (fileSystem->stat(inode_num, &inode))
@@ -71,8 +39,15 @@ int listDirectory(LocalFileSystem *fileSystem, const string &directory)
   // List directory
   if (inode.type == UFS_REGULAR_FILE)
   {
-    // Create parent inode
+    // Find and create parent inode
+    string parent = directory.substr(0, directory.find_last_of('/'));
+    int parent_inode_num = fileSystem->resolvePath(parent.empty() ? "/" : parent);
     inode_t parent_inode;
+    if (parent_inode_num < 0)
+    {
+      cerr << "Directory not found" << endl;
+      return 1;
+    }
     if (fileSystem->stat(parent_inode_num, &parent_inode))
     {
       cerr << "Directory not found" << endl;
@@ -130,7 +105,7 @@ int main(int argc, char *argv[])
   }
 
   // Parse command line arguments
-  unique_ptr<Disk> disk = make_unique<Disk>(argv[1], UFS_BLOCK_SIZE);
+  unique_ptr<Disk> disk = make_unique<Disk>(argv[1], UFS_BLOCK_SIZE, Disk::MMAP);
   unique_ptr<LocalFileSystem> fileSystem = make_unique<LocalFileSystem>(disk.get());
   string directory = string(argv[2]);
 
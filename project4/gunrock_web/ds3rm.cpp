@@ -38,5 +38,7 @@ int main(int argc, char *argv[])
     cerr << "Error removing entry" << endl;
     return 1;
   }
+  disk->commit();
+
   return 0;
 }
@@ -1,8 +1,11 @@
 #include <stdlib.h>
+#include <limits.h>
 #include <unistd.h>
 #include <assert.h>
 #include <signal.h>
+#include <time.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
 
 #include <iostream>
 #include <memory>
@@ -10,6 +13,7 @@
 #include <vector>
 #include <sstream>
 #include <deque>
+#include <set>
 
 #include "ClientError.h"
 #include "HTTPRequest.h"
@@ -20,6 +24,7 @@
 #include "DistributedFileSystemService.h"
 #include "MySocket.h"
 #include "MyServerSocket.h"
+#include "StringUtils.h"
 #include "dthread.h"
 
 using namespace std;
@@ -28,15 +33,63 @@ int THREAD_POOL_SIZE = 1;
 int BUFFER_SIZE = 1;
 string BASEDIR = "ds3";
 string SCHEDALG = "FIFO";
+// How many times SFF lets a younger request go ahead of a waiting one
+// before the waiting one has to be served, so large files can't starve
+int SFF_AGING_LIMIT = 8;
+// A persistent connection is closed once it has gone this many seconds
+// without sending a complete request, or after this many requests
+int KEEPALIVE_TIMEOUT = 5;
+int MAX_KEEPALIVE_REQUESTS = 100;
 string LOGFILE = "/dev/null";
 string DISKFILE = "disk.img";
 
 vector<HttpService *> services;
 
-HttpService *find_service(HTTPRequest *request) {
+// A connection with a complete request, waiting for a worker. cost is
+// the size of the response SFF expects. Finding it can mean going to the
+// disk, so a worker works it out without holding connections_lock, see
+// cost_next_connection.
+struct Connection {
+  MySocket *client;
+  HTTPRequest *request;
+  // requests already answered on this connection
+  int requestsServed;
+  bool isCosted;
+  // a worker is working out the cost, nobody else may take it meanwhile
+  bool isCosting;
+  long cost;
+  // how many younger connections SFF picked ahead of this one
+  int passes;
+};
+
+// Connections the main thread has accepted that no worker has picked up
+// yet, oldest first. The main thread waits while it holds BUFFER_SIZE of
+// them, and the workers wait while it's empty.
+deque<Connection> connections;
+pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t connection_ready = PTHREAD_COND_INITIALIZER;
+pthread_cond_t buffer_not_full = PTHREAD_COND_INITIALIZER;
+
+// A connection whose next request is still arriving. The epoll loop reads
+// from it whenever it's readable and hands it to the workers once the
+// request is complete, so slow and idle clients never hold up a worker.
+// Workers add connections they keep open, so the set is locked.
+struct PendingRequest {
+  MySocket *client;
+  HTTPRequest *request;
+  int requestsServed;
+  // the whole request has to arrive within KEEPALIVE_TIMEOUT of this, so
+  // a client trickling in a byte at a time can't hold on to its slot
+  time_t requestStart;
+};
+int epollFd;
+set<PendingRequest *> pending_requests;
+pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+
+HttpService *find_service(string path) {
    // find a service that is registered for this path prefix
   for (unsigned int idx = 0; idx < services.size(); idx++) {
-    if (request->getPath().find(services[idx]->pathPrefix()) == 0) {
+    if (path.find(services[idx]->pathPrefix()) == 0) {
       return services[idx];
     }
   }
@@ -44,6 +97,86 @@ HttpService *find_service(HTTPRequest *request) {
   return NULL;
 }
 
+HttpService *find_service(HTTPRequest *request) {
+  return find_service(request->getPath());
+}
+
+long request_cost(HTTPRequest *request) {
+  HttpService *service = find_service(request);
+  if (service == NULL || request->isHead()) {
+    return 0;
+  }
+  if (!request->isGet()) {
+    // we can't tell how much work a PUT or DELETE is up front
+    return LONG_MAX;
+  }
+
+  int size = service->responseSize(request->getPath());
+  return size < 0 ? LONG_MAX : size;
+}
+
+// Works out the cost of one connection that doesn't have one yet and
+// returns false if there are none. Called with connections_lock held,
+// which it drops while asking the service, so the other workers and the
+// main thread aren't held up by the disk.
+bool cost_next_connection() {
+  for (size_t idx = 0; idx < connections.size(); idx++) {
+    Connection &connection = connections[idx];
+    if (connection.isCosted || connection.isCosting) {
+      continue;
+    }
+    connection.isCosting = true;
+    HTTPRequest *request = connection.request;
+    dthread_mutex_unlock(&connections_lock);
+    long cost = request_cost(request);
+    dthread_mutex_lock(&connections_lock);
+
+    // connections may have shifted, but nobody took this one
+    for (idx = 0; connections[idx].request != request; idx++) {
+    }
+    connections[idx].cost = cost;
+    connections[idx].isCosted = true;
+    connections[idx].isCosting = false;
+    // workers waiting for a connection they can take
+    dthread_cond_broadcast(&connection_ready);
+    return true;
+  }
+  return false;
+}
+
+// Picks the connection a worker handles next and returns its position
+// in connections, which must not be empty, or connections.size() if
+// all of them are still being costed
+size_t choose_connection() {
+  if (SCHEDALG == "FIFO") {
+    return 0;
+  }
+
+  // SFF: the cheapest request, oldest first among equals, unless one of
+  // them has already waited SFF_AGING_LIMIT turns
+  size_t chosen = connections.size();
+  long chosenCost = LONG_MAX;
+  for (size_t idx = 0; idx < connections.size(); idx++) {
+    Connection &connection = connections[idx];
+    if (!connection.isCosted) {
+      continue;
+    }
+    if (connection.passes >= SFF_AGING_LIMIT) {
+      chosen = idx;
+      break;
+    }
+    if (chosen == connections.size() || connection.cost < chosenCost) {
+      chosen = idx;
+      chosenCost = connection.cost;
+    }
+  }
+
+  for (size_t idx = 0; idx < chosen; idx++) {
+    connections[idx].passes++;
+  }
+  return chosen;
+}
+
 
 void invoke_service_method(HttpService *service, HTTPRequest *request, HTTPResponse *response) {
   stringstream payload;
@@ -78,50 +211,204 @@ void invoke_service_method(HttpService *service, HTTPRequest *request, HTTPRespo
   }
 }
 
-void handle_request(MySocket *client) {
-  HTTPRequest *request = new HTTPRequest(client, PORT);
+// Answers one request and returns false if the client has gone away
+bool handle_request(MySocket *client, HTTPRequest *request, bool keepAlive) {
   HTTPResponse *response = new HTTPResponse();
   stringstream payload;
-  
-  // read in the request
-  bool readResult = false;
-  try {
-    payload << "client: " << (void *) client;
-    sync_print("read_request_enter", payload.str());
-    readResult = request->readRequest();
-    sync_print("read_request_return", payload.str());
-  } catch (...) {
-    // swallow it
-  }    
-    
-  if (!readResult) {
-    // there was a problem reading in the request, bail
-    delete response;
-    delete request;
-    sync_print("read_request_error", payload.str());
-    return;
-  }
-  
+
   HttpService *service = find_service(request);
   invoke_service_method(service, request, response);
+  response->setHeader("Connection", keepAlive ? "keep-alive" : "close");
 
   // send data back to the client and clean up
-  payload.str(""); payload.clear();
   payload << " RESPONSE " << response->getStatus() << " client: " << (void *) client;
   sync_print("write_response", payload.str());
   cout << payload.str() << endl;
-  client->write(response->response());
-    
+  bool isWritten = true;
+  try {
+    response->writeTo(client);
+  } catch (...) {
+    isWritten = false;
+  }
+
   delete response;
-  delete request;
+  return isWritten;
+}
+
+void watch_connection(MySocket *client, HTTPRequest *request, int requestsServed) {
+  PendingRequest *pending = new PendingRequest();
+  pending->client = client;
+  pending->request = request;
+  pending->requestsServed = requestsServed;
+  pending->requestStart = time(NULL);
+
+  dthread_mutex_lock(&pending_lock);
+  pending_requests.insert(pending);
+  dthread_mutex_unlock(&pending_lock);
 
-  payload.str(""); payload.clear();
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = pending;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, client->getFd(), &event);
+}
+
+void close_connection(MySocket *client) {
+  stringstream payload;
   payload << " client: " << (void *) client;
   sync_print("close_connection", payload.str());
   client->close();
   delete client;
 }
 
+// Answers the request and then any others the client already sent, and
+// goes back to waiting in the epoll loop for the next one
+void serve_connection(MySocket *client, HTTPRequest *request, int requestsServed) {
+  while (true) {
+    requestsServed++;
+    bool keepAlive = request->shouldKeepAlive() && requestsServed < MAX_KEEPALIVE_REQUESTS;
+    keepAlive = handle_request(client, request, keepAlive) && keepAlive;
+    string leftover = request->getLeftover();
+    delete request;
+    if (!keepAlive) {
+      close_connection(client);
+      return;
+    }
+
+    request = new HTTPRequest(client, PORT);
+    bool isComplete = false;
+    try {
+      isComplete = request->addBufferedData(leftover);
+    } catch (...) {
+      delete request;
+      close_connection(client);
+      return;
+    }
+    if (!isComplete) {
+      watch_connection(client, request, requestsServed);
+      return;
+    }
+  }
+}
+
+void *worker(void *arg) {
+  while (true) {
+    dthread_mutex_lock(&connections_lock);
+    size_t chosen;
+    while (true) {
+      while (connections.empty()) {
+        dthread_cond_wait(&connection_ready, &connections_lock);
+      }
+      // SFF compares every waiting request, so cost them all first
+      if (SCHEDALG == "SFF" && cost_next_connection()) {
+        continue;
+      }
+      chosen = choose_connection();
+      if (chosen < connections.size()) {
+        break;
+      }
+      dthread_cond_wait(&connection_ready, &connections_lock);
+    }
+    Connection connection = connections[chosen];
+    connections.erase(connections.begin() + chosen);
+    dthread_cond_signal(&buffer_not_full);
+    dthread_mutex_unlock(&connections_lock);
+
+    // the buffer is free for the other workers while we handle the request
+    serve_connection(connection.client, connection.request, connection.requestsServed);
+  }
+  return NULL;
+}
+
+void add_connection(MySocket *client, HTTPRequest *request, int requestsServed) {
+  Connection connection;
+  connection.client = client;
+  connection.request = request;
+  connection.requestsServed = requestsServed;
+  connection.isCosted = false;
+  connection.isCosting = false;
+  connection.cost = 0;
+  connection.passes = 0;
+
+  dthread_mutex_lock(&connections_lock);
+  while ((int) connections.size() >= BUFFER_SIZE) {
+    dthread_cond_wait(&buffer_not_full, &connections_lock);
+  }
+  connections.push_back(connection);
+  dthread_cond_signal(&connection_ready);
+  dthread_mutex_unlock(&connections_lock);
+}
+
+void accept_connections(MyServerSocket *server) {
+  // the listening socket is non-blocking, so take everything that's
+  // waiting and stop when accept fails
+  while (true) {
+    sync_print("waiting_to_accept", "");
+    MySocket *client;
+    try {
+      client = server->accept();
+    } catch (SocketError &se) {
+      return;
+    }
+    sync_print("client_accepted", "");
+    watch_connection(client, new HTTPRequest(client, PORT), 0);
+  }
+}
+
+void stop_watching(PendingRequest *pending) {
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, pending->client->getFd(), NULL);
+  dthread_mutex_lock(&pending_lock);
+  pending_requests.erase(pending);
+  dthread_mutex_unlock(&pending_lock);
+}
+
+void read_request(PendingRequest *pending) {
+  stringstream payload;
+  payload << "client: " << (void *) pending->client;
+
+  bool isComplete = false;
+  bool isError = false;
+  try {
+    isComplete = pending->request->readAvailable();
+  } catch (...) {
+    isError = true;
+  }
+  if (!isComplete && !isError) {
+    return; // wait for the rest
+  }
+
+  stop_watching(pending);
+  if (isError) {
+    // the client closed the connection or sent something we can't parse
+    sync_print("read_request_error", payload.str());
+    delete pending->request;
+    close_connection(pending->client);
+  } else {
+    sync_print("read_request_return", payload.str());
+    add_connection(pending->client, pending->request, pending->requestsServed);
+  }
+  delete pending;
+}
+
+void close_idle_connections() {
+  time_t now = time(NULL);
+  vector<PendingRequest *> idle;
+  dthread_mutex_lock(&pending_lock);
+  set<PendingRequest *>::iterator iter;
+  for (iter = pending_requests.begin(); iter != pending_requests.end(); iter++) {
+    if (now - (*iter)->requestStart >= KEEPALIVE_TIMEOUT) {
+      idle.push_back(*iter);
+    }
+  }
+  dthread_mutex_unlock(&pending_lock);
+
+  for (size_t idx = 0; idx < idle.size(); idx++) {
+    stop_watching(idle[idx]);
+    delete idle[idx]->request;
+    close_connection(idle[idx]->client);
+    delete idle[idx];
+  }
+}
+
 int main(int argc, char *argv[]) {
 
   signal(SIGPIPE, SIG_IGN);
@@ -151,28 +438,65 @@ int main(int argc, char *argv[]) {
       DISKFILE = string(optarg);
       break;
     default:
-      cerr<< "usage: " << argv[0] << " [-p port] [-t threads] [-b buffers] [-i diskFile]" << endl;
+      cerr<< "usage: " << argv[0] << " [-p port] [-t threads] [-b buffers] [-s FIFO|SFF] [-i diskFile]" << endl;
       exit(1);
     }
   }
 
+  if (SCHEDALG != "FIFO" && SCHEDALG != "SFF") {
+    cerr << "unknown scheduling policy " << SCHEDALG << ", use FIFO or SFF" << endl;
+    exit(1);
+  }
+
+  if (THREAD_POOL_SIZE < 1 || BUFFER_SIZE < 1) {
+    cerr << "threads and buffers must be positive integers" << endl;
+    exit(1);
+  }
+
   set_log_file(LOGFILE);
 
   cout << "Lisening on port " << PORT << endl;
   
   sync_print("init", "");
   MyServerSocket *server = new MyServerSocket(PORT);
-  MySocket *client;
 
   // The order that you push services dictates the search order
   // for path prefix matching
   services.push_back(new DistributedFileSystemService(DISKFILE));
   services.push_back(new FileService(BASEDIR));
+
+  for (int idx = 0; idx < THREAD_POOL_SIZE; idx++) {
+    pthread_t thread;
+    dthread_create(&thread, NULL, worker, NULL);
+    dthread_detach(thread);
+  }
   
+  // The main thread accepts connections and reads requests for all of
+  // them as data arrives. The listening socket is the one with no
+  // PendingRequest.
+  epollFd = epoll_create1(0);
+  fcntl(server->getFd(), F_SETFL, fcntl(server->getFd(), F_GETFL) | O_NONBLOCK);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, server->getFd(), &event);
+
+  struct epoll_event events[64];
+  time_t lastSweep = time(NULL);
   while(true) {
-    sync_print("waiting_to_accept", "");
-    client = server->accept();
-    sync_print("client_accepted", "");
-    handle_request(client);
+    // wake up at least once a second to close idle connections
+    int numEvents = epoll_wait(epollFd, events, 64, 1000);
+    for (int idx = 0; idx < numEvents; idx++) {
+      if (events[idx].data.ptr == NULL) {
+        accept_connections(server);
+      } else {
+        read_request((PendingRequest *) events[idx].data.ptr);
+      }
+    }
+
+    if (time(NULL) != lastSweep) {
+      close_idle_connections();
+      lastSweep = time(NULL);
+    }
   }
 }
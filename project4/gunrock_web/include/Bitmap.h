@@ -0,0 +1,39 @@
+#ifndef _BITMAP_H_
+#define _BITMAP_H_
+
+#include <stdint.h>
+
+/**
+ * A view of an on-disk bitmap, bit i is bit (i % 8) of byte (i / 8).
+ *
+ * The bitmap doesn't own its bytes, it works directly on the buffers that
+ * LocalFileSystem reads the bitmap regions into. Searches and counts look
+ * at 64 bits at a time and use ctz/popcount, so scanning a large, mostly
+ * full bitmap costs one load per 64 entries instead of one per entry.
+ */
+class Bitmap {
+ public:
+  Bitmap(unsigned char *bytes, int numBits);
+
+  bool isSet(int index);
+  void set(int index);
+  void clear(int index);
+
+  // Returns the lowest clear bit at or after start, or -1 if there isn't one
+  int findFree(int start = 0);
+  // Returns the lowest set bit at or after start, or -1 if there isn't one
+  int findSet(int start = 0);
+  // Returns the first bit of the lowest run of length clear bits at or
+  // after start, or -1 if there isn't one
+  int findFreeRun(int length, int start = 0);
+  int countSet();
+
+ private:
+  uint64_t loadWord(int wordIndex);
+
+  unsigned char *bytes;
+  int numBits;
+  int numBytes;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef _BUFFER_CACHE_H_
+#define _BUFFER_CACHE_H_
+
+#include <pthread.h>
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "Disk.h"
+
+/**
+ * An LRU cache of disk blocks that sits between LocalFileSystem and Disk.
+ *
+ * The cache is split into shards by block number, each with its own lock
+ * and LRU list, so threads working on different blocks rarely contend.
+ *
+ * Writes go straight through to the Disk and drop the cached copy rather
+ * than updating it. The Disk can still roll the write back, and in the
+ * meantime it serves reads of that block from memory anyway. Blocks that
+ * the open transaction has written aren't cached until it commits, so
+ * the cache only ever holds what every thread would read from the Disk.
+ */
+class BufferCache {
+ public:
+  BufferCache(Disk *disk, int capacityInBlocks, int numShards = 16);
+  ~BufferCache();
+
+  void readBlock(int blockNumber, void *buffer);
+  void writeBlock(int blockNumber, void *buffer);
+  // Writes the blocks with Disk::writeBlocks and drops any cached copies
+  void writeBlocks(const std::vector<std::pair<int, const void *> > &blocks);
+
+  // Drop cached copies, e.g., after something changed the image behind our back
+  void invalidate(int blockNumber);
+  void invalidateAll();
+
+  unsigned long hits();
+  unsigned long misses();
+
+ private:
+  struct Entry {
+    std::vector<unsigned char> data;
+    std::list<int>::iterator lruPosition;
+  };
+
+  struct Shard {
+    pthread_mutex_t lock;
+    int capacity;
+    // most recently used block at the front
+    std::list<int> lru;
+    std::unordered_map<int, Entry> entries;
+    unsigned long hits;
+    unsigned long misses;
+  };
+
+  Shard *shardFor(int blockNumber);
+
+  Disk *disk;
+  std::vector<Shard *> shards;
+};
+
+#endif
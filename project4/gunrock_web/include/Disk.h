@@ -1,31 +1,162 @@
 #ifndef _DISK_H_
 #define _DISK_H_
 
-#include <string>
-#include <deque>
+#include <pthread.h>
 
-struct UndoRecord {
-  int blockNumber;
-  unsigned char *blockData;
-};
+#include <string>
+#include <map>
+#include <utility>
+#include <vector>
 
 class Disk {
  public:
-  Disk(std::string imageFile, int blockSize);
+  /**
+   * How the disk image is accessed.
+   *
+   * OPEN_PER_CALL opens, seeks, and closes the image on every block access
+   * and is kept mainly as a baseline for benchmarking. PERSISTENT opens the
+   * image once in the constructor and uses pread/pwrite on that descriptor
+   * for the lifetime of the Disk object. MMAP maps the whole image into
+   * memory, so reads and writes are memcpys and durability comes from
+   * msync.
+   *
+   * Writes outside of a transaction go straight to the image and are
+   * synced before writeBlock returns. Writes inside a transaction are held
+   * in a write-back cache and reach the image at commit, which writes all
+   * of them and then syncs once. rollback just drops the cached blocks.
+   *
+   * If a journal is attached, commit instead appends the transaction to
+   * the journal with one sequential write and one sync, and the blocks are
+   * written to their home locations later, when the journal fills up or
+   * the Disk is destroyed.
+   *
+   * A Disk can be shared between threads. Reads run concurrently, while
+   * writes, commits, and checkpoints briefly hold readers off. There is
+   * only ever one open transaction: beginTransaction waits until another
+   * thread's transaction commits or rolls back, and so does a write from
+   * a thread that isn't in the open transaction, which then commits on
+   * its own. Only the thread in the transaction reads what it has written
+   * so far, other threads keep reading the committed blocks until the
+   * commit. attachJournal must be called before the Disk is shared.
+   */
+  typedef enum {OPEN_PER_CALL, PERSISTENT, MMAP} Backend;
+
+  Disk(std::string imageFile, int blockSize, Backend backend = PERSISTENT);
+  ~Disk();
   void readBlock(int blockNumber, void *buffer);
   void writeBlock(int blockNumber, void *buffer);
   int numberOfBlocks();
 
+  /**
+   * readBlock for callers that share what they read between threads,
+   * like a cache. Returns false if the open transaction has written the
+   * block, in which case the contents are either uncommitted or about to
+   * be replaced by the commit, and shouldn't be kept.
+   */
+  bool readShareableBlock(int blockNumber, void *buffer);
+
+  /**
+   * Read or write several blocks at once, given (blockNumber, buffer)
+   * pairs. Runs of consecutive block numbers in the list are transferred
+   * with a single preadv/pwritev straight to or from the callers'
+   * buffers, so listing a file's blocks in order costs one system call
+   * per extent rather than one per block. writeBlocks is atomic in the
+   * same way as a single writeBlock.
+   */
+  void readBlocks(const std::vector<std::pair<int, void *> > &blocks);
+  void writeBlocks(const std::vector<std::pair<int, const void *> > &blocks);
+
+  /**
+   * Zero-copy access to a block for read-only callers.
+   *
+   * Returns a pointer to the block inside the memory mapped image, or
+   * NULL if the disk is not using the MMAP backend. Consecutive blocks
+   * are contiguous in memory. The pointer is valid until the Disk object
+   * is destroyed and reflects committed writes to the block, but not
+   * writes from a transaction that is still in progress.
+   */
+  const void *blockPtr(int blockNumber);
+
   void beginTransaction();
   void commit();
   void rollback();
-  
+  // Whether the calling thread has a transaction open
+  bool ownsTransaction();
+
+  /**
+   * The number of transactions that have been rolled back. Callers that
+   * keep in-memory state derived from blocks they wrote can compare this
+   * against an earlier value to tell whether those writes were undone.
+   */
+  unsigned int rollbacks();
+  // The number of transactions that have been committed, for callers
+  // that need to notice when changes become visible to every thread
+  unsigned int commits();
+
+  /**
+   * Use the journal region of the image for commits.
+   *
+   * journalAddr and journalLen come from the super block. Any transactions
+   * that were committed to the journal but not yet written home, e.g.,
+   * because of a crash, are replayed before this returns.
+   */
+  void attachJournal(int journalAddr, int journalLen);
+
+  /**
+   * Write all journaled blocks to their home locations and empty the
+   * journal. Happens automatically when the journal is full.
+   */
+  void checkpoint();
+
  private:
+  void readImageBlock(int blockNumber, void *buffer);
+  void writeImageBlock(int blockNumber, const void *buffer);
+  void syncImage(int firstBlock, int lastBlock);
+  void readBlockPerCall(int blockNumber, void *buffer);
+  void writeBlockPerCall(int blockNumber, const void *buffer);
+  void readBlockPersistent(int blockNumber, void *buffer);
+  void writeBlockPersistent(int blockNumber, const void *buffer);
+  void syncMapped(int firstBlock, int lastBlock);
+  void checkBlockNumber(int blockNumber);
+  void checkWritable();
+  bool isTransactionOwner();
+  const unsigned char *bufferedBlock(int blockNumber, bool isOwner);
+  void readImageRun(int firstBlock, const std::vector<unsigned char *> &blocks);
+  void writeImageRun(int firstBlock, const std::vector<const unsigned char *> &blocks);
+  void writeImageBlocks(const std::map<int, std::vector<unsigned char> > &blocks);
+  void writeImageBlocksAndSync(const std::vector<std::pair<int, const void *> > &blocks);
+  void flushDirtyBlocks();
+  void checkpointJournal();
+  void commitToJournal();
+  void writeJournalSuper();
+  unsigned int journalChecksum(const void *desc, const std::vector<const unsigned char *> &blocks);
+
   std::string imageFile;
   int blockSize;
   int imageFileSize;
+  Backend backend;
+  int imageFileDescriptor;
+  bool isWritable;
+  unsigned char *mappedImage;
   bool isInTransaction;
-  std::deque<struct UndoRecord> undoLog;
+  pthread_t transactionOwner;
+  unsigned int rollbackCount;
+  unsigned int commitCount;
+
+  // held from beginTransaction until commit or rollback
+  pthread_mutex_t transactionLock;
+  // read locked to read blocks, write locked to change anything below
+  pthread_rwlock_t stateLock;
+  // write-back cache for the current transaction, ordered by block number
+  std::map<int, std::vector<unsigned char> > dirtyBlocks;
+
+  // journal state, journalLen is 0 when there is no journal
+  int journalAddr;
+  int journalLen;
+  int journalNext;
+  unsigned int journalSequence;
+  // committed blocks that are in the journal but not yet written home
+  std::map<int, std::vector<unsigned char> > journaledBlocks;
 };
 
 #endif
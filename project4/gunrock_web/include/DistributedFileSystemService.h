@@ -4,7 +4,11 @@
 #include "HttpService.h"
 #include "LocalFileSystem.h"
 
+#include <pthread.h>
+
+#include <map>
 #include <string>
+#include <vector>
 
 class DistributedFileSystemService : public HttpService {
  public:
@@ -13,9 +17,23 @@ class DistributedFileSystemService : public HttpService {
   virtual void get(HTTPRequest *request, HTTPResponse *response);
   virtual void put(HTTPRequest *request, HTTPResponse *response);
   virtual void del(HTTPRequest *request, HTTPResponse *response);
+  virtual int responseSize(std::string path);
 
 private:
+  // The request's path components below /ds3
+  std::vector<std::string> pathComponents(HTTPRequest *request);
+
+  // ETags come from a per-inode generation that put and del bump after
+  // they commit, qualified by instanceId since the counts start over
+  // every time the server does. Inodes don't record when they changed,
+  // and hashing the contents would mean reading all of them on every GET.
+  std::string inodeETag(int inodeNumber);
+  void bumpGenerations(const std::vector<int> &inodeNumbers);
+
   LocalFileSystem *fileSystem;
+  std::string instanceId;
+  pthread_mutex_t generationLock;
+  std::map<int, unsigned long> generations;
 };
 
 #endif
@@ -3,20 +3,79 @@
 
 #include "HttpService.h"
 
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <list>
+#include <memory>
 #include <string>
+#include <unordered_map>
 
+/**
+ * Serves the files under basedir.
+ *
+ * Small files are kept in an LRU cache of their contents, up to
+ * CACHE_CAPACITY bytes in total, so hot files are served from memory
+ * instead of being opened and read for every request. A cached copy is
+ * used only while the file's size, modification time, and inode still
+ * match what stat says, so edits and replacements are picked up on the
+ * next request. Larger files are sent with sendfile.
+ *
+ * Clients that accept gzip get a precompressed file.gz if there is one
+ * next to the file, and otherwise cached text files are compressed once
+ * and the compressed copy is cached along with the original.
+ */
 class FileService : public HttpService {
  public:
   FileService(std::string basedir);
+  ~FileService();
 
   virtual void get(HTTPRequest *request, HTTPResponse *response);
   virtual void head(HTTPRequest *request, HTTPResponse *response);
+  virtual int responseSize(std::string path);
 
 private:
   bool endswith(std::string str, std::string suffix);
   std::string readFile(std::string path);
+  void setContentType(std::string path, HTTPResponse *response);
+  bool acceptsGzip(HTTPRequest *request);
+  bool isCompressible(std::string path);
+  // Sends the file at path, described by st, honoring conditional and
+  // Range headers. isGzipped says the file is already gzipped, compress
+  // asks for it gzipped if it's in the cache.
+  void serveFile(HTTPRequest *request, HTTPResponse *response, std::string path,
+                 struct stat st, bool isGzipped, bool compress);
+  std::shared_ptr<const std::string> cachedContents(std::string path, const struct stat &st);
+  // The gzipped copy of contents, the cached contents of path, or null
+  // if compressing doesn't make it smaller
+  std::shared_ptr<const std::string> cachedGzip(std::string path, std::shared_ptr<const std::string> contents);
+  // Evicts least recently used entries, but never the most recent one,
+  // until bytes more fit in CACHE_CAPACITY. Called with m_cacheLock held.
+  void makeRoom(size_t bytes);
+
+  static const size_t CACHE_CAPACITY = 64 * 1024 * 1024;
+  static const size_t MAX_CACHED_FILE_SIZE = 1024 * 1024;
+
+  struct CachedFile {
+    std::shared_ptr<const std::string> contents;
+    // set once we've tried compressing contents, gzipped stays null if
+    // that didn't make them smaller
+    bool triedGzip;
+    std::shared_ptr<const std::string> gzipped;
+    // what the entry counts against CACHE_CAPACITY
+    size_t bytes;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+    std::list<std::string>::iterator lruPosition;
+  };
 
   std::string m_basedir;
+  pthread_mutex_t m_cacheLock;
+  // most recently used path at the front
+  std::list<std::string> m_lru;
+  std::unordered_map<std::string, CachedFile> m_cache;
+  size_t m_cacheBytes;
 };
 
 #endif
@@ -17,6 +17,9 @@ class HTTP {
     int addData(const unsigned char *data, int len);
     bool isDone();
     bool isHeaderDone();
+    // Whether the client wants the connection kept open after this
+    // message, from the HTTP version and Connection header
+    bool shouldKeepAlive();
     std::string getProxyRequest(const char *userAgent = NULL);
     std::string getReplyHeader();
     std::string getHost();
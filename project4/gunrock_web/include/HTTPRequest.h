@@ -8,8 +8,11 @@
 #include "WwwFormEncodedDict.h"
 #include "StringUtils.h"
 
+#include <sys/types.h>
+
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 class HTTPRequest {
@@ -18,6 +21,17 @@ public:
   ~HTTPRequest();
   
   bool readRequest();
+  // Parses whatever has arrived on the socket without waiting for more,
+  // and returns true once the whole request is in. Call it again when
+  // more data arrives.
+  bool readAvailable();
+  // Parses data that was read from the socket earlier, like the previous
+  // request's leftover, and returns true if that completes the request
+  bool addBufferedData(std::string data);
+  // Bytes that arrived after the end of this request, i.e., the start of
+  // the next pipelined request on the connection
+  std::string getLeftover() {return m_leftover;}
+  bool shouldKeepAlive() {return m_http->shouldKeepAlive();}
 
   std::string getHost();
   std::string getRequest();
@@ -25,6 +39,12 @@ public:
   std::string getPath();
   std::vector<std::string> getPathComponents();
   std::string getHeader(std::string key);
+  // Parses a "Range: bytes=..." header for a body of size bytes. Returns
+  // false if there's no Range header we understand, so the whole body
+  // should be sent. Otherwise ranges gets the requested (first, last)
+  // byte offsets that are inside the body, clamped to its end, and is
+  // empty if none of them are.
+  bool getRanges(off_t size, std::vector<std::pair<off_t, off_t> > &ranges);
   bool hasAuthToken();
   std::string getAuthToken();
   bool isConnect();
@@ -48,6 +68,7 @@ public:
     int m_serverPort;
     unsigned long m_totalBytesRead;
     unsigned long m_totalBytesWritten;
+    std::string m_leftover;
 };
 
 #endif
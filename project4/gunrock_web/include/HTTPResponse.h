@@ -1,28 +1,61 @@
 #ifndef HTTP_RESPONSE_H_
 #define HTTP_RESPONSE_H_
 
-#include <map>
+#include <sys/types.h>
+
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "MySocket.h"
 
 class HTTPResponse {
  public:
   HTTPResponse();
+  ~HTTPResponse();
   void withStreaming();
   void setHeader(std::string name, std::string value);
   void setBody(std::string data);
+  // Shares data with the caller instead of copying it, e.g., for a body
+  // that lives in a cache
+  void setBody(std::shared_ptr<const std::string> data);
+  // Sends length bytes of an open file, starting at offset, as the body.
+  // The response closes fd when it's done with it.
+  void setBodyFile(int fd, off_t offset, size_t length);
   void setContentType(std::string contentType);
+  std::string getContentType() {return contentType;}
   void setStatus(int status);
   int getStatus();
+  // The whole response, or just the status line and headers if the body
+  // is a file
   std::string response();
+  // Writes the response to the socket. The headers are formatted into a
+  // buffer on the stack and go out together with an in-memory body in
+  // one writev, so neither is copied into a string first. A file body
+  // goes straight from the file to the socket with sendfile.
+  void writeTo(MySocket *sock);
 
  private:
-  std::string statusToString();
+  // Big enough for the headers of any response we send ourselves, bigger
+  // ones are formatted into a string instead
+  static const size_t HEADER_BUFFER_SIZE = 1024;
+
+  const char *statusToString();
+  // Formats the status line and headers into buffer, like snprintf, and
+  // returns their length even if that's more than size
+  size_t formatHeaders(char *buffer, size_t size);
+  void closeBodyFile();
 
   int status;
   bool streaming;
-  std::map<std::string, std::string> headers;
-  std::string body;
+  // in the order they were first set, there are only ever a few
+  std::vector<std::pair<std::string, std::string> > headers;
+  std::shared_ptr<const std::string> body;
   std::string contentType;
+  int bodyFd;
+  off_t bodyFileOffset;
+  size_t bodyFileLength;
 };
 
 #endif
@@ -1,8 +1,13 @@
 #ifndef HTTP_SERVICE_H_
 #define HTTP_SERVICE_H_
 
+#include <time.h>
+#include <sys/types.h>
+
 #include <string>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 #include "MySocket.h"
 #include "HTTPRequest.h"
@@ -19,6 +24,36 @@ class HttpService {
   virtual void post(HTTPRequest *request, HTTPResponse *response);
   virtual void del(HTTPRequest *request, HTTPResponse *response);
   virtual void move(HTTPRequest *request, HTTPResponse *response);
+
+  // Roughly how many bytes a GET of path sends back, or -1 if the service
+  // can't tell without handling the request. Used to schedule requests
+  // before they are read, so it must be cheap.
+  virtual int responseSize(std::string path);
+
+ protected:
+  /**
+   * Sets the ETag header, and Last-Modified unless lastModified is 0, for
+   * a GET or HEAD. Returns true if the request's If-None-Match, or else
+   * its If-Modified-Since, says the client already has this version. The
+   * response is then a 304 with no body and the caller is done.
+   */
+  bool checkNotModified(HTTPRequest *request, HTTPResponse *response,
+                        std::string etag, time_t lastModified);
+
+  /**
+   * The (first, last) byte ranges of a size-byte body that the request
+   * asked for, or none if the whole body should be sent, e.g., because an
+   * If-Range doesn't match etag. Throws a 416 ClientError if none of the
+   * ranges are inside the body.
+   */
+  std::vector<std::pair<off_t, off_t> > requestedRanges(HTTPRequest *request, HTTPResponse *response,
+                                                        off_t size, std::string etag);
+  // The Content-Range header value for range of a size-byte body
+  std::string contentRange(std::pair<off_t, off_t> range, off_t size);
+  // Makes the response a 206 whose body is parts, the contents of ranges,
+  // as one range or a multipart/byteranges body for several
+  void setPartialBody(HTTPResponse *response, const std::vector<std::pair<off_t, off_t> > &ranges,
+                      const std::vector<std::string> &parts, off_t size);
   
  private:
   std::string m_pathPrefix;
@@ -1,8 +1,18 @@
 #ifndef _LOCAL_FILE_SYSTEM_H_
 #define _LOCAL_FILE_SYSTEM_H_
 
+#include <pthread.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "Bitmap.h"
+#include "BufferCache.h"
 #include "Disk.h"
 #include "ufs.h"
 
@@ -46,7 +56,57 @@
 
 class LocalFileSystem {
  public:
-  LocalFileSystem(Disk *disk);
+  /**
+   * Metadata blocks (the super block, bitmaps, inodes, and directory
+   * contents) are cached in a buffer cache of cacheBlocks blocks, so
+   * repeated lookups and stats don't have to go to the disk.
+   */
+  LocalFileSystem(Disk *disk, int cacheBlocks = 1024);
+  ~LocalFileSystem();
+
+  /**
+   * The public operations can be called from several threads at once.
+   *
+   * Every inode has a reader/writer lock. Reads, lookups, and path
+   * resolution take the locks of the inodes they read shared, so readers
+   * of the same or different files run in parallel. write, pwrite, create,
+   * and unlink lock the inode they change exclusively, and the allocation
+   * bitmaps have locks of their own.
+   *
+   * Each of the writing operations also runs as a Disk transaction, unless
+   * the caller already has one open, so it reaches the disk atomically
+   * with a single sync. The Disk only has one transaction open at a time,
+   * so writers take turns while readers carry on, and since a block write
+   * from another thread waits for the open transaction, the transaction
+   * has to come before any of our locks.
+   *
+   * Locks are always taken in this order, which keeps create and unlink
+   * from deadlocking with each other or with readers:
+   *
+   *   1. the Disk transaction
+   *   2. inode locks, a parent directory before the entry in it. create
+   *      locks just the parent, unlink the parent and then the target.
+   *      resolvePath holds one inode lock at a time.
+   *   3. the inode bitmap lock, then the data bitmap lock
+   *   4. the inode table, directory index, and dentry cache locks, which
+   *      are never held while taking another lock of ours
+   *
+   * stat reads an inode without locking it. invalidateSuperBlock and
+   * setAllocationPolicy must not run concurrently with anything else.
+   */
+
+  /**
+   * How data blocks are chosen when a write needs new ones.
+   *
+   * FIRST_FIT, the default, always takes the lowest numbered free block.
+   * CONTIGUOUS looks for a run of free blocks big enough for all of the
+   * new blocks, preferring the run right after the file's current last
+   * block, so files stay in as few extents as possible and can be read
+   * sequentially. It falls back to FIRST_FIT when there is no such run.
+   */
+  typedef enum {FIRST_FIT, CONTIGUOUS} AllocationPolicy;
+  void setAllocationPolicy(AllocationPolicy policy);
+
   /**
    * Lookup an inode.
    *
@@ -60,6 +120,22 @@ class LocalFileSystem {
    */
   int lookup(int parentInodeNumber, std::string name);
 
+  /**
+   * Resolve an absolute path to an inode.
+   *
+   * Walks a path like "/a/b/c.txt" from the root directory. Empty path
+   * components, like the one after a trailing "/", are ignored, so "/"
+   * is the root directory. Every step is remembered in a dentry cache,
+   * including names that don't exist, so resolving the same or a
+   * neighboring path again doesn't need to touch the disk.
+   *
+   * Success: return inode number of the last path component
+   * Failure: return -ENOTFOUND, -EINVALIDINODE.
+   * Failure modes: path isn't absolute or a component does not exist,
+   * a component other than the last one isn't a directory.
+   */
+  int resolvePath(std::string path);
+
   /**
    * Read an inode.
    *
@@ -71,6 +147,33 @@ class LocalFileSystem {
    * Failure modes: invalid inodeNumber
    */
   int stat(int inodeNumber, inode_t *inode);
+
+  /**
+   * List the disk blocks that hold the contents of a file or directory.
+   *
+   * Fills in blockNumbers with the block of each UFS_BLOCK_SIZE piece
+   * of the object, in order. Blocks past the direct pointers are found
+   * through the indirect blocks, which aren't listed themselves.
+   *
+   * Success: return 0
+   * Failure: return -EINVALIDINODE
+   * Failure modes: invalid inodeNumber
+   */
+  int blockNumbers(int inodeNumber, std::vector<int> *blockNumbers);
+
+  /**
+   * Whether a file's contents are kept in its inode instead of in data
+   * blocks. On images with inline data this is true for every regular
+   * file of up to INLINE_DATA_SIZE bytes, and such files have no blocks.
+   * Returns false for an invalid inodeNumber.
+   */
+  bool isInline(int inodeNumber);
+
+  /**
+   * The largest file or directory this image can hold, in bytes.
+   * MAX_FILE_SIZE unless the image has indirect blocks.
+   */
+  int maxFileSize();
   
   /**
    * Makes a file or directory.
@@ -113,6 +216,35 @@ class LocalFileSystem {
    */
   int read(int inodeNumber, void *buffer, int size);
 
+  /**
+   * Read part of a file or directory.
+   *
+   * Like read, but starts `offset` bytes into the object and only reads
+   * the disk blocks that hold the requested bytes. Reading at or past the
+   * end of the object returns 0.
+   *
+   * Success: number of bytes read
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE.
+   * Failure modes: invalid inodeNumber, invalid size or offset.
+   */
+  int pread(int inodeNumber, void *buffer, int size, int offset);
+
+  /**
+   * Write part of a file.
+   *
+   * Writes a buffer of size to the file starting `offset` bytes in,
+   * leaving the rest of the contents as they are and growing the file if
+   * the write goes past the end. A gap between the old end of the file
+   * and offset reads back as zeros. Only the affected blocks are written.
+   *
+   * Success: number of bytes written, fewer than size if the disk fills up
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -EINVALIDTYPE, -ENOTENOUGHSPACE.
+   * Failure modes: invalid inodeNumber, invalid size or offset (the end
+   * of the write can't be past maxFileSize()), not a regular file, no
+   * room for any of the data.
+   */
+  int pwrite(int inodeNumber, const void *buffer, int size, int offset);
+
   /**
    * Remove a file or directory.
    *
@@ -135,6 +267,14 @@ class LocalFileSystem {
    */
   void readSuperBlock(super_t *super);
 
+  /**
+   * The super block and the layout derived from it are read once, when
+   * the LocalFileSystem is created. Tools that reformat the image
+   * underneath a live LocalFileSystem must call this afterwards so that
+   * it re-reads the super block and drops any cached blocks.
+   */
+  void invalidateSuperBlock();
+
   // Helper functions, you should read/write the entire inode and bitmap regions
   void readInodeBitmap(super_t *super, unsigned char *inodeBitmap);
   void writeInodeBitmap(super_t *super, unsigned char *inodeBitmap);
@@ -147,6 +287,155 @@ class LocalFileSystem {
   // it in a function you add that is not part of the LocalFileSystem object but
   // can still access the disk.
   Disk *disk;
+
+  // All block writes go through the cache so that it never holds stale
+  // copies. If you write to the disk directly, invalidate the cache.
+  BufferCache *cache;
+
+ private:
+  void loadSuperBlock();
+
+  // Per-inode locks, NULL for inode numbers that are out of range
+  pthread_rwlock_t *inodeLock(int inodeNumber);
+  std::vector<pthread_rwlock_t> inodeLocks;
+  pthread_mutex_t inodeBitmapLock;
+  pthread_mutex_t dataBitmapLock;
+  // Serializes read-modify-writes of inode table blocks, which hold
+  // several inodes
+  pthread_mutex_t inodeTableLock;
+  pthread_mutex_t indexLock;
+  pthread_mutex_t dentryLock;
+
+  // lookup and pread without taking the inode lock, for callers that
+  // already hold it
+  int lookupEntry(int parentInodeNumber, const std::string &name);
+  int readRange(int inodeNumber, void *buffer, int size, int offset);
+
+  // Read or write a single inode, without any validation
+  void readInode(int inodeNumber, inode_t *inode);
+  void writeInode(int inodeNumber, inode_t *inode);
+  bool isInodeAllocated(int inodeNumber);
+
+  // Whether an inode of this type and size keeps its data inline, and
+  // how many data blocks the inode currently has
+  bool fitsInline(inode_t *inode, int size);
+  int blocksInUse(inode_t *inode);
+
+  // Frees or allocates data blocks so that the inode has numBlocks of
+  // them, as far as space allows, and returns how many it has now. The
+  // inode itself isn't written, but indirect blocks are.
+  int resizeBlocks(inode_t *inode, int numBlocks);
+
+  // Indirect and double indirect blocks read or changed while working
+  // on an inode's block pointers. The changed ones are written back
+  // together by writePointerBlocks.
+  struct PointerBlocks {
+    std::map<int, std::vector<unsigned int> > blocks;
+    std::set<int> dirty;
+  };
+  unsigned int *pointerBlock(int blockNumber, PointerBlocks *pointers);
+  void writePointerBlocks(PointerBlocks *pointers);
+
+  // Returns where the address of the inode's block blockIndex is kept,
+  // either in the inode or in an indirect block, which is then stored in
+  // pointerBlockNumber (-1 for the inode)
+  unsigned int *blockSlot(inode_t *inode, int blockIndex, PointerBlocks *pointers, int *pointerBlockNumber);
+  // Appends the addresses of numBlocks of the inode's blocks, starting
+  // at firstBlock, to blockNumbers
+  void mapBlocks(inode_t *inode, int firstBlock, int numBlocks, std::vector<int> *blockNumbers);
+
+  // Block allocation for resizeBlocks. Blocks come from the run at
+  // runStart if there is one (>= 0), otherwise from the lowest free block
+  int allocateBlock(Bitmap *dataBits, int *runStart);
+  void releaseBlock(int blockNumber, Bitmap *dataBits, PointerBlocks *pointers);
+  // The number of indirect blocks a file of numBlocks blocks uses
+  int pointerBlocksFor(int numBlocks);
+  // Allocates any indirect blocks that block blockIndex is the first
+  // user of, returns false if there isn't room for them
+  bool allocatePointerBlocks(inode_t *inode, int blockIndex, Bitmap *dataBits, PointerBlocks *pointers, int *runStart);
+  // Frees the indirect blocks a file of oldBlocks blocks uses but a file
+  // of numBlocks blocks doesn't
+  void freePointerBlocks(inode_t *inode, int numBlocks, int oldBlocks, Bitmap *dataBits, PointerBlocks *pointers);
+
+  // Replaces the contents of a file or directory, reusing its current data
+  // blocks and allocating or freeing blocks as needed. Returns the number
+  // of bytes written, which is less than size if the disk is full.
+  int writeContents(int inodeNumber, inode_t *inode, const void *buffer, int size);
+
+  // Writes size bytes at offset into a file or directory, touching only
+  // the blocks in that range. Returns the number of bytes written, which
+  // is less than size if the disk fills up, or -ENOTENOUGHSPACE, leaving
+  // the inode as it was, if none of them fit. Inline files that grow too
+  // big move out to data blocks.
+  int writeRange(int inodeNumber, inode_t *inode, const void *buffer, int size, int offset);
+  int writeBlockRange(int inodeNumber, inode_t *inode, const void *buffer, int size, int offset);
+  // Writes into an inline file, offset + size must fit in the inode
+  int writeInline(int inodeNumber, inode_t *inode, const void *buffer, int size, int offset);
+
+  // Cached super block and layout
+  super_t superBlock;
+  int inodesPerBlock;
+  int inodeBitmapBytes;
+  int dataBitmapBytes;
+  bool hasIndirectBlocks;
+  bool hasInlineData;
+
+  // Lower bounds on the lowest free inode and data block, so allocation
+  // skips the part of the bitmaps that is known to be full. They are only
+  // hints, every allocation still checks the bitmap itself.
+  int inodeHint;
+  int dataHint;
+
+  // In-memory hash index of a directory's entries, built the first time
+  // the directory is searched and kept up to date by create and unlink,
+  // so finding a name doesn't scan the whole directory. The contents of
+  // an index are protected by the directory's inode lock, and the map by
+  // indexLock. Callers hold a reference so an index can be evicted while
+  // it is in use.
+  struct DirectoryIndex {
+    std::vector<dir_ent_t> entries;
+    // name -> position in entries
+    std::unordered_map<std::string, int> slots;
+  };
+  std::shared_ptr<DirectoryIndex> directoryIndex(int inodeNumber, inode_t *inode);
+  std::unordered_map<int, std::shared_ptr<DirectoryIndex> > directoryIndexes;
+
+  // Other threads read a directory's committed contents until the
+  // transaction that changes it commits, so create and unlink take the
+  // index they change out of directoryIndexes first. Until the commit
+  // only the thread in the transaction uses it, other threads build
+  // throwaway indexes instead, and nobody caches dentries under the
+  // directory. checkRollbacks puts the indexes back after the commit.
+  // index may be null, e.g., for a directory being removed. Protected by
+  // indexLock.
+  void touchDirectory(int inodeNumber, std::shared_ptr<DirectoryIndex> index);
+  std::unordered_map<int, std::shared_ptr<DirectoryIndex> > touchedDirectories;
+
+  // Dentry cache for resolvePath, keyed by directory inode and then
+  // name. A negative entry, for a name that doesn't exist, has an
+  // inodeNumber of -ENOTFOUND. create and unlink invalidate the entries
+  // for the names they change. Entries are added and removed while
+  // holding the directory's inode lock, so a lookup can't race with a
+  // create or unlink and cache a stale answer.
+  struct Dentry {
+    int inodeNumber;
+    int type;
+  };
+  int lookupDentry(int parentInodeNumber, const std::string &name, Dentry *dentry);
+  void invalidateDentry(int parentInodeNumber, const std::string &name);
+  std::unordered_map<int, std::unordered_map<std::string, Dentry> > dentries;
+  size_t dentryCount;
+
+  // The hints, indexes, and dentries reflect our own writes, which a Disk
+  // rollback can undo, so they are dropped when the rollback count
+  // changes, and the touched directories' indexes are shared once the
+  // commit count does. Called at the start of operations, before taking
+  // any bitmap locks.
+  void checkRollbacks();
+  std::atomic<unsigned int> seenRollbacks;
+  std::atomic<unsigned int> seenCommits;
+
+  AllocationPolicy allocationPolicy;
 };  
 
 #endif
@@ -12,6 +12,28 @@
 
 #define MAX_FILE_SIZE (DIRECT_PTRS * UFS_BLOCK_SIZE)
 
+// Images with UFS_FEATURE_INDIRECT set in super_t.features use the last
+// two direct pointers for an indirect block, which holds PTRS_PER_BLOCK
+// more block pointers, and a double indirect block, which holds pointers
+// to indirect blocks. Files on those images are only limited by the int
+// size field. Images without it use all DIRECT_PTRS pointers for data.
+#define UFS_FEATURE_INDIRECT (0x1)
+
+#define NUM_DIRECT (DIRECT_PTRS - 2)
+#define INDIRECT_PTR (DIRECT_PTRS - 2)
+#define DOUBLE_INDIRECT_PTR (DIRECT_PTRS - 1)
+#define PTRS_PER_BLOCK ((int)(UFS_BLOCK_SIZE / sizeof(unsigned int)))
+
+#define MAX_INDIRECT_FILE_SIZE (0x7fffffff / UFS_BLOCK_SIZE * UFS_BLOCK_SIZE)
+
+// Images with UFS_FEATURE_INLINE_DATA keep the contents of regular files
+// of up to INLINE_DATA_SIZE bytes in the inode itself, in place of the
+// direct pointers, and don't give them any data blocks. Bytes past the
+// end of an inline file are zero.
+#define UFS_FEATURE_INLINE_DATA (0x2)
+
+#define INLINE_DATA_SIZE ((int)(DIRECT_PTRS * sizeof(unsigned int)))
+
 // Note: Bitmap indexes identify disk blocks relative to the start of a region.
 
 typedef struct {
@@ -38,7 +60,29 @@ typedef struct __super {
     int data_region_len;   // in blocks
     int num_inodes;        // just the number of inodes
     int num_data;          // and data blocks...
+    int journal_addr;      // block address (in blocks), after the data region
+    int journal_len;       // in blocks, 0 if the image has no journal
+    int features;          // UFS_FEATURE_* flags, 0 on older images
 } super_t;
 
+// The journal region is a redo log. Its first block is a journal_super_t
+// and the rest holds committed transactions back to back, each one a
+// journal_desc_t block followed by the new contents of the blocks it lists.
+#define UFS_JOURNAL_MAGIC (0x4a524e4c)
+
+typedef struct {
+    unsigned int magic;      // UFS_JOURNAL_MAGIC
+    unsigned int sequence;   // sequence number of the first live transaction
+} journal_super_t;
+
+#define JOURNAL_DESC_PTRS ((UFS_BLOCK_SIZE / sizeof(unsigned int)) - 4)
+typedef struct {
+    unsigned int magic;      // UFS_JOURNAL_MAGIC
+    unsigned int sequence;   // one more than the transaction before it
+    unsigned int num_blocks; // number of block images after this descriptor
+    unsigned int checksum;   // over this block (with checksum 0) and the block images
+    unsigned int blocks[JOURNAL_DESC_PTRS]; // where each block image belongs
+} journal_desc_t;
+
 
 #endif // __ufs_h__
@@ -11,7 +11,7 @@
 
 void usage()
 {
-    fprintf(stderr, "usage: mkfs -f <image_file> [-d <num_data_blocks] [-i <num_inodes>]\n");
+    fprintf(stderr, "usage: mkfs -f <image_file> [-d <num_data_blocks] [-i <num_inodes>] [-j <num_journal_blocks>] [-I] [-N]\n");
     exit(1);
 }
 
@@ -21,9 +21,11 @@ int main(int argc, char *argv[])
     char *image_file = NULL;
     int num_inodes = 32;
     int num_data = 32;
+    int num_journal = 0;
+    int features = 0;
     int visual = 0;
 
-    while ((ch = getopt(argc, argv, "i:d:f:v")) != -1)
+    while ((ch = getopt(argc, argv, "i:d:f:j:INv")) != -1)
     {
         switch (ch)
         {
@@ -36,6 +38,18 @@ int main(int argc, char *argv[])
         case 'f':
             image_file = optarg;
             break;
+        case 'j':
+            num_journal = atoi(optarg);
+            break;
+        case 'I':
+            // the last two direct pointers become an indirect and a
+            // double indirect block
+            features |= UFS_FEATURE_INDIRECT;
+            break;
+        case 'N':
+            // small files live in their inodes
+            features |= UFS_FEATURE_INLINE_DATA;
+            break;
         case 'v':
             visual = 1;
             break;
@@ -66,6 +80,8 @@ int main(int argc, char *argv[])
 
     assert(num_inodes >= 32);
     assert(num_data >= 32);
+    // the journal needs its own header plus room for at least one transaction
+    assert(num_journal == 0 || num_journal >= 2);
 
     // presumed: block 0 is the super block
     super_t s;
@@ -99,7 +115,14 @@ int main(int argc, char *argv[])
     s.data_region_addr = s.inode_region_addr + s.inode_region_len;
     s.data_region_len = num_data;
 
-    int total_blocks = 1 + s.inode_bitmap_len + s.data_bitmap_len + s.inode_region_len + s.data_region_len;
+    // journal goes last so the rest of the layout matches images without one
+    s.journal_addr = num_journal > 0 ? s.data_region_addr + s.data_region_len : 0;
+    s.journal_len = num_journal;
+
+    // without any options the image has the original layout
+    s.features = features;
+
+    int total_blocks = 1 + s.inode_bitmap_len + s.data_bitmap_len + s.inode_region_len + s.data_region_len + s.journal_len;
 
     // super block is the first block
     int rc = pwrite(fd, &s, sizeof(super_t), 0);
@@ -115,6 +138,8 @@ int main(int argc, char *argv[])
     printf("layout details\n");
     printf("  inode bitmap address/len %d [%d]\n", s.inode_bitmap_addr, s.inode_bitmap_len);
     printf("  data bitmap address/len  %d [%d]\n", s.data_bitmap_addr, s.data_bitmap_len);
+    printf("  journal address/len      %d [%d]\n", s.journal_addr, s.journal_len);
+    printf("  features                 %d\n", s.features);
 
     // first, zero out all the blocks
     int i;
@@ -195,6 +220,19 @@ int main(int argc, char *argv[])
     rc = pwrite(fd, &parent, UFS_BLOCK_SIZE, s.data_region_addr * UFS_BLOCK_SIZE);
     assert(rc == UFS_BLOCK_SIZE);
 
+    //
+    // an empty journal: just the header, the first transaction will
+    // get sequence number 1
+    //
+    if (s.journal_len > 0)
+    {
+        journal_super_t js;
+        js.magic = UFS_JOURNAL_MAGIC;
+        js.sequence = 1;
+        rc = pwrite(fd, &js, sizeof(journal_super_t), s.journal_addr * UFS_BLOCK_SIZE);
+        assert(rc == sizeof(journal_super_t));
+    }
+
     if (visual)
     {
         int i;
@@ -208,6 +246,8 @@ int main(int argc, char *argv[])
             printf("I");
         for (i = 0; i < s.data_region_len; i++)
             printf("D");
+        for (i = 0; i < s.journal_len; i++)
+            printf("J");
         printf("\n\n");
     }
 
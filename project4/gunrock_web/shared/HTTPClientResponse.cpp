@@ -5,34 +5,31 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <stdlib.h>
 
+#include <algorithm>
 #include <sstream>
 
 using namespace std;
 
-HTTPClientResponse::HTTPClientResponse(MySocket *sock) {
+HTTPClientResponse::HTTPClientResponse(MySocket *sock, bool is_head_request) {
     m_sock = sock;
     m_status_code = 0;
+    m_keep_alive = false;
+    m_is_head_request = is_head_request;
 }
 
 
 string HTTPClientResponse::readResponse() {
+  // read up to the end of the headers
   string full_response;
-
-  while (true) {
-    string response;
+  size_t delimiter;
+  while ((delimiter = full_response.find("\r\n\r\n")) == string::npos) {
     try {
-      response = m_sock->read();
+      full_response += m_sock->read();
     } catch (...) {
-      break;
+      return "";
     }
-
-    full_response += response;
-  }
-
-  size_t delimiter = full_response.find("\r\n\r\n");
-  if (delimiter == string::npos) {
-    return "";
   }
 
   m_body = full_response.substr(delimiter+4);
@@ -41,12 +38,52 @@ string HTTPClientResponse::readResponse() {
 
   string line;
   while (getline(header_stream, line)) {
+    if (line.size() > 0 && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    size_t colon = line.find(':');
     if (line.find("HTTP/1.1 ") == 0 || line.find("HTTP/1.0") == 0) {
       stringstream header_line(line);
       string http;
       header_line >> http >> m_status_code >> m_status_message;
+    } else if (colon != string::npos) {
+      // header names are case insensitive
+      string key = line.substr(0, colon);
+      transform(key.begin(), key.end(), key.begin(), ::tolower);
+      size_t value = line.find_first_not_of(' ', colon + 1);
+      m_headers[key] = value == string::npos ? "" : line.substr(value);
+    }
+  }
+
+  if (m_is_head_request || m_status_code / 100 == 1 || m_status_code == 204 ||
+      m_status_code == 304) {
+    // these never have a body, whatever the headers say
+    m_body = "";
+    m_keep_alive = m_headers["connection"] != "close";
+    return m_body;
+  }
+
+  if (m_headers.count("content-length") == 0) {
+    // without a length the body runs until the server closes the connection
+    while (true) {
+      try {
+        m_body += m_sock->read();
+      } catch (...) {
+        break;
+      }
+    }
+    return m_body;
+  }
+
+  size_t content_length = strtoul(m_headers["content-length"].c_str(), NULL, 10);
+  while (m_body.size() < content_length) {
+    try {
+      m_body += m_sock->read();
+    } catch (...) {
+      return m_body;
     }
   }
-  
+  m_body.resize(content_length);
+  m_keep_alive = m_headers["connection"] != "close";
   return m_body;
 }
@@ -17,13 +17,15 @@ HttpClient::HttpClient(const char *inet_addr, int port, bool use_tls) {
   } else {
     connection = new MySocket(inet_addr, port);
   }
+  this->address = inet_addr;
+  this->port = port;
+  this->is_reusable = false;
   
   stringstream host;
   host << inet_addr << ":" << port;
   headers["Host"] = host.str();
   headers["User-Agent"] = string("Gunrock/1.0");
   headers["Accept"] = string("*/*");
-  headers["Connection"] = string("close");
 }
 
 HttpClient::~HttpClient() {
@@ -44,6 +46,12 @@ void HttpClient::set_basic_auth(string username, string password) {
 void HttpClient::write_request(string path, string method, string body) {
   stringstream request;
 
+  if (connection->getFd() < 0) {
+    // the last response closed the connection
+    delete connection;
+    connection = new MySocket(address.c_str(), port);
+  }
+
   // PART 1: implement support for handling the body, if it exists
   request << method << " " << path << " HTTP/1.1\r\n";
   if (body.size() > 0) {
@@ -66,32 +74,70 @@ void HttpClient::write_request(string path, string method, string body) {
   }
   
   connection->write(request.str());
+  sent_methods.push_back(method);
 }
 
 
 
 HTTPClientResponse *HttpClient::read_response() {
-  HTTPClientResponse *response = new HTTPClientResponse(connection);
+  // responses come back in the order the requests went out
+  string method = "";
+  if (!sent_methods.empty()) {
+    method = sent_methods.front();
+    sent_methods.pop_front();
+  }
+  HTTPClientResponse *response = new HTTPClientResponse(connection, method == "HEAD");
   response->readResponse();
+  is_reusable = response->keepAlive();
+  if (!is_reusable) {
+    connection->close();
+    sent_methods.clear();
+  }
   return response;
 }
 
-HTTPClientResponse *HttpClient::get(string path) {
-  write_request(path, "GET", "");
+HTTPClientResponse *HttpClient::send_request(string path, string method, string body) {
+  if (is_reusable && method != "GET" && method != "HEAD") {
+    // a request that isn't safe to repeat is never sent twice, so check
+    // that the server hasn't closed the connection we kept open before
+    // sending it, and give up if it fails anyway
+    try {
+      connection->readNonBlocking();
+    } catch (...) {
+      connection->close();
+    }
+  } else if (is_reusable) {
+    // the server may have closed the connection we kept open, e.g., after
+    // its idle timeout, so if nothing comes back try again on a new one
+    try {
+      write_request(path, method, body);
+      HTTPClientResponse *response = read_response();
+      if (response->status() != 0) {
+        return response;
+      }
+      delete response;
+    } catch (SocketWriteError &swe) {
+    }
+    connection->close();
+    sent_methods.clear();
+  }
+
+  write_request(path, method, body);
   return read_response();
 }
 
+HTTPClientResponse *HttpClient::get(string path) {
+  return send_request(path, "GET", "");
+}
+
 HTTPClientResponse *HttpClient::post(string path, string body) {
-  write_request(path, "POST", body);
-  return read_response();
+  return send_request(path, "POST", body);
 }
 
 HTTPClientResponse *HttpClient::put(string path, string body) {
-  write_request(path, "PUT", body);
-  return read_response();
+  return send_request(path, "PUT", body);
 }
 
 HTTPClientResponse *HttpClient::del(string path) {
-  write_request(path, "DELETE", "");
-  return read_response();
+  return send_request(path, "DELETE", "");
 }
@@ -1,11 +1,16 @@
 #include "MySocket.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include <iostream>
 
@@ -80,6 +85,60 @@ void MySocket::write_bytes(const void *buffer, int len) {
     }
 }
 
+void MySocket::writeBuffers(const struct iovec *buffers, int count) {
+    if (sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+    // a short write leaves us partway through some buffer, so work on a
+    // copy we can advance
+    vector<struct iovec> remaining(buffers, buffers + count);
+    size_t idx = 0;
+    while(true) {
+        while(idx < remaining.size() && remaining[idx].iov_len == 0) {
+            idx++;
+        }
+        if(idx == remaining.size()) {
+            break;
+        }
+
+        ssize_t bytesWritten = ::writev(sockFd, &remaining[idx], remaining.size() - idx);
+        if(bytesWritten < 0 && errno == EINTR) {
+            continue;
+        }
+        if(bytesWritten <= 0) {
+	  throw SocketWriteError();
+        }
+        for(; bytesWritten > 0; idx++) {
+            size_t step = min((size_t) bytesWritten, remaining[idx].iov_len);
+            remaining[idx].iov_base = (char *) remaining[idx].iov_base + step;
+            remaining[idx].iov_len -= step;
+            bytesWritten -= step;
+            if(remaining[idx].iov_len > 0) {
+                break;
+            }
+        }
+    }
+}
+
+void MySocket::sendFile(int fd, off_t offset, size_t count) {
+    if (sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+    // sendfile advances offset for us and can stop short, like write
+    while(count > 0) {
+        ssize_t bytesSent = ::sendfile(sockFd, fd, &offset, count);
+        if(bytesSent < 0 && errno == EINTR) {
+            continue;
+        }
+        if(bytesSent <= 0) {
+	  throw SocketWriteError();
+        }
+        count -= bytesSent;
+    }
+}
+
 string MySocket::read() {
     char buffer[4096];
     if(sockFd<0) {
@@ -95,6 +154,24 @@ string MySocket::read() {
     return string(buffer, ret);
 }
 
+string MySocket::readNonBlocking() {
+    char buffer[4096];
+    if(sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+    int ret = ::recv(sockFd, buffer, sizeof(buffer), MSG_DONTWAIT);
+
+    if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      return "";
+    }
+    if(ret <= 0) {
+      throw SocketReadError();
+    }
+
+    return string(buffer, ret);
+}
+
 void MySocket::close(void) {
     if(sockFd<0) return;
     
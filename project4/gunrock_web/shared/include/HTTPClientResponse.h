@@ -8,11 +8,14 @@
 
 class HTTPClientResponse {
  public:
-  HTTPClientResponse(MySocket *sock);    
+  // is_head_request because a response to HEAD has headers but no body
+  HTTPClientResponse(MySocket *sock, bool is_head_request = false);
   std::string readResponse();
   int status() { return m_status_code; }
   bool success() { return m_status_code >= 200 && m_status_code < 300; }
   std::string body() { return m_body; }
+  // whether the server left the connection open for another request
+  bool keepAlive() { return m_keep_alive; }
   
  protected:
   MySocket *m_sock;
@@ -20,6 +23,8 @@ class HTTPClientResponse {
   std::map<std::string, std::string> m_headers;
   int m_status_code;
   std::string m_status_message;
+  bool m_keep_alive;
+  bool m_is_head_request;
 };
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef __HTTP_CLIENT_H__
 #define __HTTP_CLIENT_H__
 
+#include <deque>
 #include <string>
 #include <map>
 
@@ -98,7 +99,16 @@ class HttpClient {
   HTTPClientResponse *read_response();
   
  private:
+  HTTPClientResponse *send_request(std::string path, std::string method, std::string body);
+
+  std::string address;
+  int port;
+  // the connection is kept open between requests while the server allows it
   MySocket *connection;
+  bool is_reusable;
+  // methods of the requests whose responses haven't been read yet, since
+  // responses to HEAD have no body
+  std::deque<std::string> sent_methods;
   std::map<std::string, std::string> headers;
 };
   
@@ -1,6 +1,9 @@
 #ifndef MYSOCKET_H
 #define MYSOCKET_H
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include <stdexcept>
 #include <string>
 
@@ -51,7 +54,29 @@ class MySocket {
 
   virtual std::string read();
   virtual void write(std::string data);
+
+  /*
+   * writes count bytes of the open file fd, starting at offset, with
+   * sendfile, so the kernel copies them to the socket directly.
+   */
+  virtual void sendFile(int fd, off_t offset, size_t count);
+
+  /*
+   * writes count buffers back to back with writev, so several pieces
+   * of a message go out in one system call without being copied into
+   * one buffer first.
+   */
+  virtual void writeBuffers(const struct iovec *buffers, int count);
+
+  /*
+   * like read, but returns an empty string instead of blocking when
+   * nothing has arrived yet.  Throws SocketReadError once the other
+   * side has closed the connection.
+   */
+  virtual std::string readNonBlocking();
   virtual void close(void);
+
+  int getFd() { return sockFd; }
   
  protected:
   void call_connect(const char *inetAddr, int port);